@@ -0,0 +1,15 @@
+# write commit of SOURCE_DIR to OUTPUT as GIT_COMMIT (run at each build by the git_commit target)
+# the file is rewritten only if the commit changes, so that sources including it are not recompiled otherwise
+execute_process( COMMAND git rev-parse --short HEAD WORKING_DIRECTORY ${SOURCE_DIR} OUTPUT_VARIABLE GIT_COMMIT OUTPUT_STRIP_TRAILING_WHITESPACE ERROR_QUIET )
+if( NOT GIT_COMMIT )
+	set( GIT_COMMIT unknown )
+endif()
+
+set( CONTENT "#define GIT_COMMIT \"${GIT_COMMIT}\"\n" )
+set( OLD_CONTENT "" )
+if( EXISTS ${OUTPUT} )
+	file( READ ${OUTPUT} OLD_CONTENT )
+endif()
+if( NOT CONTENT STREQUAL OLD_CONTENT )
+	file( WRITE ${OUTPUT} "${CONTENT}" )
+endif()
@@ -0,0 +1,122 @@
+/**
+ *  benchmark of bvh builders on random sphere sets
+ *
+ *  bench_bvh [N] [--threads=T] [--bins=B1,B2,...] [--rays=R] [--trials=K]
+ *      build bvh over N (default 1000000) random spheres in the unit cube with the median split (bins = 0) and binned SAH (default bins = 4,8,16,32),
+ *      single-threaded and with a thread pool of T threads (default: number of hardware threads),
+ *      and report the median build time of K (default 3) trials, SAH cost of the tree and closest-hit rays per second for R (default 1000000) random rays.
+ *      the number of hits and the sum of their distances are printed to check that all trees return the same closest hits
+ */
+
+#include"inc/base/bvh.hpp"
+#include"inc/base/rng.hpp"
+#include"inc/base/sphere.hpp"
+
+#include<chrono>
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<iostream>
+#include<algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	size_t n = 1000000;
+	size_t num_threads = std::thread::hardware_concurrency();
+	size_t num_rays = 1000000;
+	size_t num_trials = 3;
+	std::vector<size_t> bins{ 4, 8, 16, 32 };
+	for(int i = 1; i < argc; i++){
+		const std::string arg = argv[i];
+		const std::string val = arg.substr(arg.find('=') + 1);
+		if(arg.rfind("--threads=", 0) == 0){
+			num_threads = std::stoul(val);
+		}else if(arg.rfind("--bins=", 0) == 0){
+			bins.clear();
+			for(size_t pos = 0; pos < val.size(); pos = val.find(',', pos) + 1){
+				bins.push_back(std::stoul(val.substr(pos)));
+				if(val.find(',', pos) == std::string::npos){
+					break;
+				}
+			}
+		}else if(arg.rfind("--rays=", 0) == 0){
+			num_rays = std::stoul(val);
+		}else if(arg.rfind("--trials=", 0) == 0){
+			num_trials = std::max<size_t>(std::stoul(val), 1);
+		}else if((arg.size() > 0) && (arg[0] != '-')){
+			n = std::stoul(arg);
+		}else{
+			std::cerr << "unknown option: " << arg << std::endl; return 2;
+		}
+	}
+
+	//random spheres (covering about 1/4 of the cube) and random rays starting in the cube
+	random_number_generator rng;
+	const float r = 0.5f / std::cbrt(float(n));
+	std::vector<sphere> spheres;
+	spheres.reserve(n);
+	for(size_t i = 0; i < n; i++){
+		const float x = rng.generate_uniform_real(), y = rng.generate_uniform_real(), z = rng.generate_uniform_real();
+		spheres.emplace_back(vec3(x, y, z), r * (0.5f + rng.generate_uniform_real()));
+	}
+	std::vector<vec3> origins(num_rays), directions(num_rays);
+	for(size_t i = 0; i < num_rays; i++){
+		origins[i] = vec3(rng.generate_uniform_real(), rng.generate_uniform_real(), rng.generate_uniform_real());
+		const float cos_theta = 1 - 2 * rng.generate_uniform_real();
+		const float sin_theta = std::sqrt(std::max(0.0f, 1 - cos_theta * cos_theta));
+		const float phi = 2 * 3.14159265f * rng.generate_uniform_real();
+		directions[i] = vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+	}
+
+	thread_pool pool(num_threads);
+	std::cout << "primitives = " << n << ", rays = " << num_rays << ", threads = " << pool.num_threads() << ", trials = " << num_trials << std::endl;
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-8s %-8s %12s %10s %10s %16s %10s %14s", "bins", "threads", "build [ms]", "nodes", "SAH cost", "rays/s", "hits", "sum of t");
+	std::cout << line << std::endl;
+
+	std::vector<size_t> configs{ 0 };
+	configs.insert(configs.end(), bins.begin(), bins.end());
+	for(const size_t B : configs){
+		for(thread_pool *p_pool : { static_cast<thread_pool*>(nullptr), &pool }){
+
+			//median build time of trials
+			bvh bvh;
+			std::vector<double> times;
+			for(size_t k = 0; k < num_trials; k++){
+				const auto start = std::chrono::steady_clock::now();
+				bvh.build(n, [&](const size_t i){ return spheres[i].bounds(); }, p_pool, B);
+				times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+			}
+			std::sort(times.begin(), times.end());
+
+			//closest hits (traversal does not depend on the pool, so that it is measured once per number of bins)
+			char rays[32] = "-", hits[32] = "-", sum_t[32] = "-";
+			if(p_pool == nullptr){
+				size_t num_hits = 0;
+				double sum = 0;
+				const auto start = std::chrono::steady_clock::now();
+				for(size_t i = 0; i < num_rays; i++){
+					float t = 2;
+					bvh.traverse(origins[i], directions[i], 0, t, [&](const size_t j){
+						spheres[j].intersect(origins[i], directions[i], t, 0); return false;
+					});
+					if(t < 2){
+						num_hits++; sum += t;
+					}
+				}
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				std::snprintf(rays, sizeof(rays), "%.4g", num_rays / seconds);
+				std::snprintf(hits, sizeof(hits), "%zu", num_hits);
+				std::snprintf(sum_t, sizeof(sum_t), "%.6f", sum);
+			}
+			std::snprintf(line, sizeof(line), "%-8s %-8zu %12.1f %10zu %10.2f %16s %10s %14s", (B == 0) ? "median" : std::to_string(B).c_str(), (p_pool == nullptr) ? size_t(1) : pool.num_threads(), times[times.size() / 2], bvh.num_nodes(), bvh.sah_cost(), rays, hits, sum_t);
+			std::cout << line << std::endl;
+		}
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
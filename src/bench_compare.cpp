@@ -0,0 +1,237 @@
+/**
+ *  comparison of benchmark results written by simple_ris_bpt --results=FILE
+ *
+ *  bench_compare run N COMMAND...
+ *      run COMMAND N times (repeated trials, COMMAND should append its result with --results=FILE)
+ *  bench_compare FILE BASE CANDIDATE [--threshold=PERCENT] [--alpha=ALPHA]
+ *      compare trials labeled BASE and CANDIDATE (labels are commits unless --label is given) for each config and machine,
+ *      and report speedups with 95% confidence intervals and p-values of Welch's t-test.
+ *      metrics which are significantly (p < ALPHA, default 0.05) worse by more than PERCENT (default 2) are flagged as regressions,
+ *      and the exit code is 1 if any regression is found
+ */
+
+#include"inc/base/benchmark_result.hpp"
+
+#include<map>
+#include<cmath>
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<iostream>
+#include<algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//statistics
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//regularized incomplete beta function I_x(a,b) (continued fraction by modified Lentz's method)
+inline double incomplete_beta(const double a, const double b, const double x)
+{
+	if((x <= 0) || (x >= 1)){
+		return (x <= 0) ? 0 : 1;
+	}
+	if(x > (a + 1) / (a + b + 2)){
+		return 1 - incomplete_beta(b, a, 1 - x);
+	}
+	const double tiny = 1e-300;
+	const double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x)) / a;
+
+	double f = 1, c = 1, d = 0;
+	for(int i = 0; i <= 400; i++){
+		const int m = i / 2;
+		double numerator;
+		if(i == 0){
+			numerator = 1;
+		}else if(i % 2 == 0){
+			numerator = (m * (b - m) * x) / ((a + 2 * m - 1) * (a + 2 * m));
+		}else{
+			numerator = -((a + m) * (a + b + m) * x) / ((a + 2 * m) * (a + 2 * m + 1));
+		}
+		d = 1 + numerator * d;
+		d = 1 / ((std::abs(d) < tiny) ? tiny : d);
+		c = 1 + numerator / c;
+		c = (std::abs(c) < tiny) ? tiny : c;
+		f *= c * d;
+		if(std::abs(1 - c * d) < 1e-12){
+			break;
+		}
+	}
+	return front * (f - 1);
+}
+
+//two-sided p-value of t with df degrees of freedom (Student's t-distribution)
+inline double t_test_p(const double t, const double df)
+{
+	return incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+//return t such that the two-sided p-value is p (e.g., 0.05 for 95% confidence intervals)
+inline double t_quantile(const double p, const double df)
+{
+	double lo = 0, hi = 1e3;
+	for(int i = 0; i < 100; i++){
+		const double mid = (lo + hi) / 2;
+		if(t_test_p(mid, df) > p){
+			lo = mid;
+		}else{
+			hi = mid;
+		}
+	}
+	return (lo + hi) / 2;
+}
+
+//sample mean and variance
+struct sample_stats
+{
+	explicit sample_stats(const std::vector<double> &values) : n(values.size()), mean(), var()
+	{
+		for(const double v : values){
+			mean += v / n;
+		}
+		for(const double v : values){
+			var += (n > 1) ? (v - mean) * (v - mean) / (n - 1) : 0;
+		}
+	}
+
+	size_t n;
+	double mean;
+	double var;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	if((argc >= 4) && (std::string(argv[1]) == "run")){
+
+		//repeated trials
+		const size_t num_trials = std::stoul(argv[2]);
+		std::string command;
+		for(int i = 3; i < argc; i++){
+			command += std::string(i > 3 ? " " : "") + argv[i];
+		}
+		for(size_t k = 0; k < num_trials; k++){
+			std::cout << "trial " << k + 1 << "/" << num_trials << ": " << command << std::endl;
+			if(std::system(command.c_str()) != 0){
+				std::cerr << "trial failed" << std::endl; return 2;
+			}
+		}
+		return 0;
+	}
+	if(argc < 4){
+		std::cerr << "usage: bench_compare run N COMMAND...\n       bench_compare FILE BASE CANDIDATE [--threshold=PERCENT] [--alpha=ALPHA]" << std::endl;
+		return 2;
+	}
+
+	const std::string filename = argv[1];
+	const std::string base = argv[2];
+	const std::string candidate = argv[3];
+	double threshold = 0.02;
+	double alpha = 0.05;
+	for(int i = 4; i < argc; i++){
+		const std::string arg = argv[i];
+		const std::string val = arg.substr(arg.find('=') + 1);
+		if(arg.rfind("--threshold=", 0) == 0){
+			threshold = std::stod(val) / 100;
+		}else if(arg.rfind("--alpha=", 0) == 0){
+			alpha = std::stod(val);
+		}else{
+			std::cerr << "unknown option: " << arg << std::endl; return 2;
+		}
+	}
+
+	//trials of base (0) and candidate (1) for each config and machine
+	const auto results = load_benchmark_results(filename);
+	std::map<std::pair<std::string, std::string>, std::vector<const benchmark_result*>[2]> groups;
+	for(const auto &r : results){
+		if((r.label == base) || (r.label == candidate)){
+			groups[std::make_pair(r.config, r.machine)][(r.label == base) ? 0 : 1].push_back(&r);
+		}
+	}
+
+	size_t num_regressions = 0, num_compared = 0;
+	for(const auto &group : groups){
+
+		const auto &trials = group.second;
+		if(trials[0].empty() || trials[1].empty()){
+			continue;
+		}
+		num_compared++;
+		std::cout << "config: \"" << group.first.first << "\", machine: " << group.first.second;
+		std::cout << ", trials: " << trials[0].size() << " (" << base << ") vs " << trials[1].size() << " (" << candidate << ")" << std::endl;
+
+		char line[256];
+		std::snprintf(line, sizeof(line), "  %-30s %-23s %-23s %-25s %-8s", "metric", "base", "candidate", "speedup (95% CI)", "p");
+		std::cout << line << std::endl;
+
+		//metrics of the first trial of base (iterations are not compared, since they differ only with time limits)
+		for(const auto &m : trials[0][0]->metrics){
+
+			const std::string &name = m.first;
+			if(name == "iterations"){
+				continue;
+			}
+			std::vector<double> values[2];
+			for(int k = 0; k < 2; k++){
+				for(const benchmark_result *r : trials[k]){
+					if(const double *v = r->metric(name)){
+						values[k].push_back(*v);
+					}
+				}
+			}
+			if(values[0].empty() || values[1].empty()){
+				continue;
+			}
+			const sample_stats a(values[0]), b(values[1]);
+
+			//speedup > 1 is an improvement (base/candidate for times, candidate/base for rates)
+			const bool higher_better = is_higher_better(name);
+			const double speedup = higher_better ? b.mean / a.mean : a.mean / b.mean;
+
+			//Welch's t-test, and confidence interval of log(speedup) by the delta method
+			double p = -1, lo = 0, hi = 0;
+			if((a.n >= 2) && (b.n >= 2) && (a.mean > 0) && (b.mean > 0)){
+				const double va = a.var / a.n, vb = b.var / b.n;
+				if(va + vb > 0){
+					const double df = (va + vb) * (va + vb) / (va * va / (a.n - 1) + vb * vb / (b.n - 1));
+					p = t_test_p((b.mean - a.mean) / std::sqrt(va + vb), df);
+					const double se = std::sqrt(va / (a.mean * a.mean) + vb / (b.mean * b.mean));
+					const double t = t_quantile(0.05, df);
+					lo = speedup * std::exp(-t * se);
+					hi = speedup * std::exp(t * se);
+				}else{
+					p = (a.mean == b.mean) ? 1 : 0; lo = hi = speedup;
+				}
+			}
+
+			const char *flag = "";
+			if((p >= 0) && (p < alpha)){
+				if(speedup < 1 - threshold){
+					flag = "REGRESSION"; num_regressions++;
+				}else if(speedup > 1 + threshold){
+					flag = "improvement";
+				}
+			}
+			char ci[64] = "n/a", pv[32] = "n/a";
+			if(p >= 0){
+				std::snprintf(ci, sizeof(ci), "%.3f [%.3f, %.3f]", speedup, lo, hi);
+				std::snprintf(pv, sizeof(pv), "%.3g", p);
+			}else{
+				std::snprintf(ci, sizeof(ci), "%.3f", speedup);
+			}
+			char sa[64], sb[64];
+			std::snprintf(sa, sizeof(sa), "%.4g +- %.2g", a.mean, std::sqrt(a.var));
+			std::snprintf(sb, sizeof(sb), "%.4g +- %.2g", b.mean, std::sqrt(b.var));
+			std::snprintf(line, sizeof(line), "  %-30s %-23s %-23s %-25s %-8s %s", name.c_str(), sa, sb, ci, pv, flag);
+			std::cout << line << std::endl;
+		}
+	}
+	if(num_compared == 0){
+		std::cerr << "no config has trials of both " << base << " and " << candidate << " in " << filename << std::endl;
+		return 2;
+	}
+	std::cout << num_regressions << " regression(s)" << std::endl;
+	return (num_regressions > 0) ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
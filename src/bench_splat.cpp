@@ -0,0 +1,143 @@
+/**
+ *  benchmark of splatting into images of scanline and Morton-tiled layouts
+ *
+ *  bench_splat [N] [--size=S] [--trials=K]
+ *      splat N (default 16000000) RGB contributions into an S x S (default 2048) float image of each layout, and report the median
+ *      rate of K (default 3) trials. splats are clustered around random centers (16 splats per center, normal offsets of sigma 4
+ *      and 32 pixels, as light sub-path vertices seen from nearby points) or uniformly distributed.
+ *      accumulation adds the image to a scanline image of doubles, as the renderer adds the light tracing buffer to the screen.
+ *      the sums of the images are printed to check that both layouts store the same values
+ */
+
+#include"inc/base/image.hpp"
+#include"inc/base/rng.hpp"
+
+#include<cfloat>
+#include<chrono>
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<cstring>
+#include<iostream>
+#include<algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return median time of trials of func in seconds
+template<class Func> double median_time(const size_t num_trials, Func func)
+{
+	std::vector<double> times;
+	for(size_t k = 0; k < num_trials; k++){
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	return times[times.size() / 2];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//splat contributions at (xs[i],ys[i]) into img and accumulate img into sum, and print rates
+template<class Layout> void run(const char *name, const char *pattern, const std::vector<int> &xs, const std::vector<int> &ys, const int size, const size_t num_trials)
+{
+	Image<float, Layout> img(size, size);
+	imaged sum(size, size);
+
+	const double t_splat = median_time(num_trials, [&](){
+		memset(img.data(), 0, sizeof(float) * img.size());
+		for(size_t i = 0; i < xs.size(); i++){
+			float *p = img(xs[i], ys[i]);
+			p[0] += 1.0f;
+			p[1] += 0.5f;
+			p[2] += 0.25f;
+		}
+	});
+	const double t_accumulate = median_time(num_trials, [&](){
+		for(int y = 0; y < size; y++){
+			for(int x = 0; x < size; x++){
+				sum(x, y)[0] += img(x, y)[0];
+				sum(x, y)[1] += img(x, y)[1];
+				sum(x, y)[2] += img(x, y)[2];
+			}
+		}
+	});
+
+	double total = 0;
+	for(int y = 0; y < size; y++){
+		for(int x = 0; x < size; x++){
+			total += img(x, y)[0] + img(x, y)[1] + img(x, y)[2];
+		}
+	}
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-12s %-10s %14.1f %16.1f %14.0f", pattern, name, xs.size() / t_splat * 1e-6, double(size) * size / t_accumulate * 1e-6, total);
+	std::cout << line << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+	size_t n = 16000000;
+	int size = 2048;
+	size_t num_trials = 3;
+	for(int i = 1; i < argc; i++){
+		const std::string arg = argv[i];
+		const std::string val = arg.substr(arg.find('=') + 1);
+		if(arg.rfind("--size=", 0) == 0){
+			size = std::max(std::stoi(val), 1);
+		}else if(arg.rfind("--trials=", 0) == 0){
+			num_trials = std::max<size_t>(std::stoul(val), 1);
+		}else if((arg.size() > 0) && (arg[0] != '-')){
+			n = std::stoul(arg);
+		}else{
+			std::cerr << "unknown option: " << arg << std::endl; return 2;
+		}
+	}
+
+	std::cout << "splats = " << n << ", image = " << size << "x" << size << ", trials = " << num_trials << std::endl;
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-12s %-10s %14s %16s %14s", "pattern", "layout", "Msplat/s", "accumulate Mpix/s", "sum");
+	std::cout << line << std::endl;
+
+	random_number_generator rng;
+	for(const float sigma : { 4.0f, 32.0f, 0.0f }){
+
+		//splat positions (sigma = 0: uniform)
+		std::vector<int> xs(n), ys(n);
+		float cx = 0, cy = 0;
+		for(size_t i = 0; i < n; i++){
+			if(sigma == 0){
+				xs[i] = std::min(int(rng.generate_uniform_real() * size), size - 1);
+				ys[i] = std::min(int(rng.generate_uniform_real() * size), size - 1);
+				continue;
+			}
+			if(i % 16 == 0){
+				cx = rng.generate_uniform_real() * size;
+				cy = rng.generate_uniform_real() * size;
+			}
+			//Box-Muller transform
+			const float r = sigma * std::sqrt(-2 * std::log(std::max(rng.generate_uniform_real(), FLT_MIN)));
+			const float phi = 2 * 3.14159265f * rng.generate_uniform_real();
+			xs[i] = std::min(std::max(int(cx + r * std::cos(phi)), 0), size - 1);
+			ys[i] = std::min(std::max(int(cy + r * std::sin(phi)), 0), size - 1);
+		}
+
+		const std::string pattern = (sigma == 0) ? std::string("uniform") : "sigma " + std::to_string(int(sigma));
+		run<scanline_layout>("scanline", pattern.c_str(), xs, ys, size, num_trials);
+		run<morton_layout>("tiled", pattern.c_str(), xs, ys, size, num_trials);
+	}
+
+	//conversion of the tiled layout for output
+	imagef_tiled tiled(size, size);
+	const double t_convert = median_time(num_trials, [&](){
+		const imagef img = to_scanline(tiled);
+		(void)img;
+	});
+	std::cout << "to_scanline: " << double(size) * size / t_convert * 1e-6 << " Mpix/s" << std::endl;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -7,15 +7,28 @@
 #include"base/ray.hpp"
 #include"base/rng.hpp"
 #include"base/math.hpp"
+#include"base/morton.hpp"
+#include"base/aabb.hpp"
+#include"base/bvh.hpp"
 #include"base/scene.hpp"
 #include"base/image.hpp"
 #include"base/sphere.hpp"
 #include"base/object.hpp"
 #include"base/camera.hpp"
+#include"base/denoiser.hpp"
 #include"base/kd_tree.hpp"
 #include"base/parallel.hpp"
 #include"base/distribution.hpp"
+#include"base/directional_distribution.hpp"
 #include"base/intersection.hpp"
 #include"base/material.hpp"
+#include"base/mapped_array.hpp"
+#include"base/perf_counter.hpp"
+#include"base/huge_page_allocator.hpp"
+#include"base/allocation_counter.hpp"
+#include"base/ray_counter.hpp"
+#include"base/prometheus.hpp"
+#include"base/benchmark_result.hpp"
+#include"base/shared_framebuffer.hpp"
 
 #endif
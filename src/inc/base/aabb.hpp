@@ -0,0 +1,74 @@
+
+#pragma once
+
+#ifndef AABB_HPP
+#define AABB_HPP
+
+#include<cfloat>
+#include<algorithm>
+#include"math.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//aabb
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//axis-aligned bounding box
+class aabb
+{
+public:
+
+	//empty box
+	aabb() : m_min(FLT_MAX), m_max(-FLT_MAX)
+	{
+	}
+	aabb(const vec3 &min, const vec3 &max) : m_min(min), m_max(max)
+	{
+	}
+
+	const vec3 &min() const
+	{
+		return m_min;
+	}
+	const vec3 &max() const
+	{
+		return m_max;
+	}
+	vec3 center() const
+	{
+		return (m_min + m_max) * 0.5f;
+	}
+
+	//return surface area (used in SAH cost)
+	float surface_area() const
+	{
+		const vec3 e = m_max - m_min;
+		return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	//enlarge box to include box b
+	void expand(const aabb &b)
+	{
+		m_min = vec3(std::min(m_min.x, b.m_min.x), std::min(m_min.y, b.m_min.y), std::min(m_min.z, b.m_min.z));
+		m_max = vec3(std::max(m_max.x, b.m_max.x), std::max(m_max.y, b.m_max.y), std::max(m_max.z, b.m_max.z));
+	}
+
+	//slab test of ray o+t*d (inv_d: 1/d) in [t_min, t_max]
+	bool intersect(const vec3 &o, const vec3 &inv_d, const float t_min, const float t_max) const
+	{
+		const float tx1 = (m_min.x - o.x) * inv_d.x, tx2 = (m_max.x - o.x) * inv_d.x;
+		const float ty1 = (m_min.y - o.y) * inv_d.y, ty2 = (m_max.y - o.y) * inv_d.y;
+		const float tz1 = (m_min.z - o.z) * inv_d.z, tz2 = (m_max.z - o.z) * inv_d.z;
+		const float t0 = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), t_min));
+		const float t1 = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), t_max));
+		return (t0 <= t1);
+	}
+
+private:
+
+	vec3 m_min;
+	vec3 m_max;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
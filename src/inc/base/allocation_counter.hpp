@@ -0,0 +1,53 @@
+
+#pragma once
+
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include<atomic>
+#include<vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//allocation counter
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//number of heap allocations by operator new
+//allocations are counted only if count_allocations.hpp is included in one translation unit (otherwise it stays 0)
+inline std::atomic<size_t> num_allocations(0);
+
+//add number of heap allocations in the scope to count (e.g., for each stage of an iteration)
+class allocation_scope
+{
+public:
+
+	explicit allocation_scope(size_t &count) : m_count(count), m_start(num_allocations.load(std::memory_order_relaxed))
+	{
+	}
+	allocation_scope(const allocation_scope&) = delete;
+	allocation_scope &operator=(const allocation_scope&) = delete;
+	~allocation_scope()
+	{
+		m_count += num_allocations.load(std::memory_order_relaxed) - m_start;
+	}
+
+private:
+
+	size_t &m_count;
+	size_t m_start;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//reserve capacity for n elements with 25% headroom, so that sizes fluctuating between iterations do not reallocate
+template<class T, class Allocator> inline void reserve_with_headroom(std::vector<T, Allocator> &v, const size_t n)
+{
+	if(v.capacity() < n){
+		v.reserve(n + n / 4);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,267 @@
+
+#pragma once
+
+#ifndef BENCHMARK_RESULT_HPP
+#define BENCHMARK_RESULT_HPP
+
+#include<string>
+#include<vector>
+#include<thread>
+#include<cstdlib>
+#include<fstream>
+#include<sstream>
+#include<utility>
+
+#if !defined(_WIN32)
+#include<unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//benchmark_result
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//result of a benchmark run (a trial) stored as a row of CSV file or a line of JSON Lines file
+//schema: label, commit, machine, config (strings identifying the run) followed by named metrics (numbers)
+//metrics named *_per_second or efficiency are better if higher, and the others (e.g., *_seconds, rmse) are better if lower
+struct benchmark_result
+{
+	std::string label;   //name of the compared version (commit if not given)
+	std::string commit;  //commit of the source code of the program
+	std::string machine; //machine fingerprint (host, CPU model and number of hardware threads)
+	std::string config;  //options of the run (runs with the same config and machine are compared)
+	std::vector<std::pair<std::string, double>> metrics;
+
+	void add(const std::string &name, const double value)
+	{
+		metrics.emplace_back(name, value);
+	}
+
+	//return pointer to metric name (nullptr if not found)
+	const double *metric(const std::string &name) const
+	{
+		for(const auto &m : metrics){
+			if(m.first == name){
+				return &m.second;
+			}
+		}
+		return nullptr;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return true if higher values of metric name are better
+inline bool is_higher_better(const std::string &name)
+{
+	const std::string suffix = "_per_second";
+	return (name == "efficiency") || ((name.size() >= suffix.size()) && (name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return fingerprint of this machine (host name, CPU model and number of hardware threads)
+inline std::string machine_fingerprint()
+{
+	std::string host = "unknown", cpu = "unknown";
+#if !defined(_WIN32)
+	char name[256] = {};
+	if(gethostname(name, sizeof(name) - 1) == 0){
+		host = name;
+	}
+#endif
+#if defined(__linux__)
+	std::ifstream ifs("/proc/cpuinfo");
+	for(std::string line; std::getline(ifs, line);){
+		if(line.rfind("model name", 0) == 0){
+			const size_t pos = line.find(':');
+			cpu = (pos != std::string::npos) ? line.substr(line.find_first_not_of(' ', pos + 1)) : line;
+			break;
+		}
+	}
+#endif
+	return host + "/" + cpu + "/" + std::to_string(std::thread::hardware_concurrency()) + "T";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//quote field of CSV if it contains separators or quotes
+inline std::string csv_field(const std::string &s)
+{
+	if(s.find_first_of(",\"\n") == std::string::npos){
+		return s;
+	}
+	std::string quoted = "\"";
+	for(const char c : s){
+		quoted += (c == '"') ? std::string("\"\"") : std::string(1, c);
+	}
+	return quoted + "\"";
+}
+
+//split line of CSV into fields
+inline std::vector<std::string> split_csv(const std::string &line)
+{
+	std::vector<std::string> fields(1);
+	bool quoted = false;
+	for(size_t i = 0; i < line.size(); i++){
+		const char c = line[i];
+		if(quoted){
+			if((c == '"') && (i + 1 < line.size()) && (line[i + 1] == '"')){
+				fields.back() += '"'; i++;
+			}else if(c == '"'){
+				quoted = false;
+			}else{
+				fields.back() += c;
+			}
+		}else if(c == '"'){
+			quoted = true;
+		}else if(c == ','){
+			fields.emplace_back();
+		}else if(c != '\r'){
+			fields.back() += c;
+		}
+	}
+	return fields;
+}
+
+//escape string for JSON
+inline std::string json_string(const std::string &s)
+{
+	std::string escaped = "\"";
+	for(const char c : s){
+		if((c == '"') || (c == '\\')){
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped + "\"";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//append result to filename (JSON Lines if filename ends with .json or .jsonl, CSV otherwise)
+//a header row is written to CSV files before the first row and whenever the metrics differ from the previous header
+inline bool append_benchmark_result(const benchmark_result &result, const std::string &filename)
+{
+	std::ostringstream line;
+	line.precision(9);
+
+	auto ends_with = [&](const std::string &suffix){
+		return (filename.size() >= suffix.size()) && (filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0);
+	};
+	const bool json = ends_with(".json") || ends_with(".jsonl");
+	if(json){
+		line << "{\"label\":" << json_string(result.label) << ",\"commit\":" << json_string(result.commit);
+		line << ",\"machine\":" << json_string(result.machine) << ",\"config\":" << json_string(result.config);
+		for(const auto &m : result.metrics){
+			line << "," << json_string(m.first) << ":" << m.second;
+		}
+		line << "}\n";
+	}else{
+		std::string header = "label,commit,machine,config";
+		for(const auto &m : result.metrics){
+			header += "," + m.first;
+		}
+
+		//find last header of the file
+		std::string last_header;
+		{
+			std::ifstream ifs(filename);
+			for(std::string l; std::getline(ifs, l);){
+				if(l.rfind("label,", 0) == 0){
+					last_header = l;
+				}
+			}
+		}
+		if(last_header != header){
+			line << header << "\n";
+		}
+		line << csv_field(result.label) << "," << csv_field(result.commit) << "," << csv_field(result.machine) << "," << csv_field(result.config);
+		for(const auto &m : result.metrics){
+			line << "," << m.second;
+		}
+		line << "\n";
+	}
+
+	std::ofstream ofs(filename, std::ios::app);
+	ofs << line.str();
+	return bool(ofs);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//load results appended by append_benchmark_result (CSV or JSON Lines, determined by the first character of each line)
+inline std::vector<benchmark_result> load_benchmark_results(const std::string &filename)
+{
+	std::vector<benchmark_result> results;
+	std::vector<std::string> header;
+
+	auto set = [](benchmark_result &r, const std::string &key, const std::string &value){
+		if(key == "label"){
+			r.label = value;
+		}else if(key == "commit"){
+			r.commit = value;
+		}else if(key == "machine"){
+			r.machine = value;
+		}else if(key == "config"){
+			r.config = value;
+		}else if(!value.empty()){
+			r.add(key, std::strtod(value.c_str(), nullptr));
+		}
+	};
+
+	std::ifstream ifs(filename);
+	for(std::string line; std::getline(ifs, line);){
+		if(line.empty()){
+			continue;
+		}
+		benchmark_result r;
+		if(line[0] == '{'){
+
+			//flat object of strings and numbers written by append_benchmark_result
+			size_t i = 1;
+			auto read_string = [&](){
+				std::string s;
+				for(i++; (i < line.size()) && (line[i] != '"'); i++){
+					if(line[i] == '\\'){
+						i++;
+					}
+					s += line[i];
+				}
+				i++;
+				return s;
+			};
+			while((i < line.size()) && (line[i] == '"')){
+				const std::string key = read_string();
+				i++; //colon
+				std::string value;
+				if(line[i] == '"'){
+					value = read_string();
+				}else{
+					const size_t end = line.find_first_of(",}", i);
+					value = line.substr(i, end - i);
+					i = end;
+				}
+				set(r, key, value);
+				if(line[i] == ','){
+					i++;
+				}
+			}
+		}else{
+			const auto fields = split_csv(line);
+			if(fields[0] == "label"){
+				header = fields; continue;
+			}
+			for(size_t k = 0; (k < fields.size()) && (k < header.size()); k++){
+				set(r, header[k], fields[k]);
+			}
+		}
+		results.push_back(r);
+	}
+	return results;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
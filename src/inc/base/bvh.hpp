@@ -0,0 +1,488 @@
+
+#pragma once
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include<vector>
+#include<cassert>
+#include<cstdint>
+#include<algorithm>
+#include"aabb.hpp"
+#include"parallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//bvh
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//bounding volume hierarchy over primitives 0,...,n-1 (primitives themselves are stored by the user)
+//nodes are stored in breadth-first order, so that nodes of each depth are contiguous and refit() updates depths bottom-up in parallel
+class bvh
+{
+public:
+
+	//maximum number of primitives in a leaf
+	static const size_t max_leaf_size = 2;
+
+	//maximum depth of leaves (the root has depth 0), so that traversal stacks of stack_size entries do not overflow
+	//binned SAH falls back to the median split when a node could otherwise exceed it (see num_split_bins())
+	static const size_t stack_size = 64;
+	static const size_t max_depth = stack_size - 2;
+
+	//maximum number of rays of a packet
+	static const size_t max_packet_size = 64;
+
+	struct node{
+		aabb bounds;
+		uint32_t idx;   //index of left child (right child is idx+1) or index of first primitive in m_prims (leaf)
+		uint16_t count; //number of primitives (0 for internal node)
+		uint16_t axis;  //split axis (centroids of left child are smaller)
+	};
+
+	//default number of bins of binned SAH (0: median split)
+	//the median split is the default, since binned SAH builds slower and showed no traversal gain on the measured scenes
+	static const size_t default_num_bins = 0;
+	static const size_t max_num_bins = 64;
+
+	//n: number of primitives, bounds: function object that returns aabb of i-th primitive (called once per primitive, in parallel if p_pool is given)
+	//num_bins trades build time for tree quality: primitives are split by binned SAH with num_bins bins per axis (e.g., 4 is faster, 32 is closer to full SAH),
+	//or at the median of centroids along the longest axis if num_bins is less than 2 (fastest build, highest SAH cost)
+	//nodes are built level by level: nodes of each depth are split in parallel with pool, and a large node is binned and partitioned by all threads
+	//(a task-parallel recursion would lose the breadth-first order, and the pool does not run nested loops)
+	template<class Bounds> void build(const size_t n, Bounds bounds, thread_pool *p_pool = nullptr, const size_t num_bins = default_num_bins)
+	{
+		m_nodes.clear();
+		m_levels.clear();
+		m_prims.resize(n);
+		if(n == 0){
+			return;
+		}
+		const size_t B = std::min(num_bins, max_num_bins);
+
+		//bounds of primitives (partitioned together with primitive indices, so that nodes read contiguous ranges)
+		std::vector<prim_ref> refs(n);
+		parallel_for(p_pool, n, [&](const size_t i){
+			refs[i] = prim_ref{ bounds(i), uint32_t(i) };
+		});
+
+		struct task{
+			uint32_t node, begin, end;
+		};
+		std::vector<task> level(1, task{ 0, 0, uint32_t(n) }), next_level;
+		std::vector<split> splits;
+		m_nodes.push_back(node{ aabb(), 0, 0, 0 });
+		while(!level.empty()){
+
+			m_levels.push_back(level.front().node);
+			splits.resize(level.size());
+			const size_t depth = m_levels.size() - 1;
+
+			//large nodes are split one by one using all threads, and the other nodes are split in parallel
+			const size_t group_size = 64; //number of small nodes split by a task
+			std::vector<size_t> small;
+			for(size_t i = 0; i < level.size(); i++){
+				if((p_pool != nullptr) && (level[i].end - level[i].begin > parallel_node_size)){
+					splits[i] = split_node(refs, level[i].begin, level[i].end, num_split_bins(B, depth, level[i].end - level[i].begin), p_pool);
+				}else{
+					small.push_back(i);
+				}
+			}
+			auto split_group = [&](const size_t g){
+				for(size_t k = g * group_size, e = std::min(k + group_size, small.size()); k < e; k++){
+					const task &t = level[small[k]];
+					splits[small[k]] = split_node(refs, t.begin, t.end, num_split_bins(B, depth, t.end - t.begin), nullptr);
+				}
+			};
+			const size_t num_groups = (small.size() + group_size - 1) / group_size;
+			if((p_pool != nullptr) && (num_groups > 1)){
+				p_pool->run(int(num_groups), [&](const int g){ split_group(size_t(g)); });
+			}else{
+				for(size_t g = 0; g < num_groups; g++){
+					split_group(g);
+				}
+			}
+
+			//children are appended in order of their parents, so that nodes of the next depth are contiguous
+			next_level.clear();
+			for(size_t i = 0; i < level.size(); i++){
+
+				const task &t = level[i];
+				node &node = m_nodes[t.node];
+				node.bounds = splits[i].box;
+				if(t.end - t.begin <= max_leaf_size){
+					assert(depth <= max_depth);
+					node.idx = t.begin;
+					node.count = uint16_t(t.end - t.begin);
+					continue;
+				}
+				const uint32_t left = uint32_t(m_nodes.size());
+				node.idx = left;
+				node.count = 0;
+				node.axis = splits[i].axis;
+				m_nodes.push_back(bvh::node{ aabb(), 0, 0, 0 });
+				m_nodes.push_back(bvh::node{ aabb(), 0, 0, 0 });
+				next_level.push_back(task{ left, t.begin, splits[i].mid });
+				next_level.push_back(task{ left + 1, splits[i].mid, t.end });
+			}
+			std::swap(level, next_level);
+		}
+		m_levels.push_back(uint32_t(m_nodes.size()));
+		parallel_for(p_pool, n, [&](const size_t i){
+			m_prims[i] = refs[i].prim;
+		});
+	}
+
+	//update bounds of all nodes bottom-up after primitives moved (the tree topology is kept)
+	//nodes of each depth are processed in parallel with pool (sequentially if p_pool is nullptr or the depth has few nodes)
+	template<class Bounds> void refit(Bounds bounds, thread_pool *p_pool = nullptr)
+	{
+		if(m_nodes.empty()){
+			return;
+		}
+		auto refit_node = [&](const size_t i)
+		{
+			node &node = m_nodes[i];
+			aabb box;
+			if(node.count > 0){
+				for(uint32_t j = 0; j < node.count; j++){
+					box.expand(bounds(m_prims[node.idx + j]));
+				}
+			}else{
+				box = m_nodes[node.idx].bounds;
+				box.expand(m_nodes[node.idx + 1].bounds);
+			}
+			node.bounds = box;
+		};
+
+		const size_t grain = 1024; //number of nodes processed by a task
+		for(size_t d = m_levels.size() - 1; d-- > 0;){
+
+			const size_t begin = m_levels[d];
+			const size_t end = m_levels[d + 1];
+			if((p_pool != nullptr) && (end - begin > grain)){
+				p_pool->run(int((end - begin + grain - 1) / grain), [&](const int task)
+				{
+					for(size_t i = begin + task * grain, e = std::min(i + grain, end); i < e; i++){
+						refit_node(i);
+					}
+				});
+			}else{
+				for(size_t i = begin; i < end; i++){
+					refit_node(i);
+				}
+			}
+		}
+	}
+
+	//visit primitives whose leaves intersect ray o+t*d in [t_min, t_max]
+	//func(i) is called for primitive i and returns true to terminate traversal (t_max can be shortened by func for closest hit)
+	//return true if traversal is terminated by func
+	template<class Func> bool traverse(const vec3 &o, const vec3 &d, const float t_min, const float &t_max, Func func) const
+	{
+		if(m_nodes.empty()){
+			return false;
+		}
+		const vec3 inv_d(1 / d.x, 1 / d.y, 1 / d.z);
+
+		uint32_t stack[stack_size];
+		size_t size = 0;
+		stack[size++] = 0;
+		while(size > 0){
+
+			const node &node = m_nodes[stack[--size]];
+			if(node.bounds.intersect(o, inv_d, t_min, t_max) == false){
+				continue;
+			}
+			if(node.count > 0){
+				for(uint32_t j = 0; j < node.count; j++){
+					if(func(m_prims[node.idx + j])){
+						return true;
+					}
+				}
+			}else{
+				//nearer child is visited first
+				const bool flip = (d[node.axis] < 0);
+				stack[size++] = node.idx + (flip ? 0 : 1);
+				stack[size++] = node.idx + (flip ? 1 : 0);
+			}
+		}
+		return false;
+	}
+
+	//visit primitives whose leaves intersect at least one of n (<= max_packet_size) rays o+t*(dx[i],dy[i],dz[i]) in [t_min, t_max[i]] (active[i] is false for finished rays)
+	//func(i) is called once for each visited primitive i
+	template<class Func> void traverse(const vec3 &o, const float *dx, const float *dy, const float *dz, const float t_min, const float *t_max, const bool *active, const size_t n, Func func) const
+	{
+		if(m_nodes.empty()){
+			return;
+		}
+		assert(n <= max_packet_size);
+		vec3 inv_d[max_packet_size];
+		for(size_t i = 0; i < n; i++){
+			inv_d[i] = vec3(1 / dx[i], 1 / dy[i], 1 / dz[i]);
+		}
+
+		uint32_t stack[stack_size];
+		size_t size = 0;
+		stack[size++] = 0;
+		while(size > 0){
+
+			const node &node = m_nodes[stack[--size]];
+			bool hit = false;
+			for(size_t i = 0; (i < n) && (hit == false); i++){
+				hit = active[i] && node.bounds.intersect(o, inv_d[i], t_min, t_max[i]);
+			}
+			if(hit == false){
+				continue;
+			}
+			if(node.count > 0){
+				for(uint32_t j = 0; j < node.count; j++){
+					func(m_prims[node.idx + j]);
+				}
+			}else{
+				stack[size++] = node.idx;
+				stack[size++] = node.idx + 1;
+			}
+		}
+	}
+
+	//return bounds of all primitives
+	aabb bounds() const
+	{
+		return m_nodes.empty() ? aabb() : m_nodes[0].bounds;
+	}
+
+	//return SAH cost of the tree (expected number of visited nodes and tested primitives of a ray hitting the root, ignoring early termination)
+	float sah_cost() const
+	{
+		if(m_nodes.empty()){
+			return 0;
+		}
+		const float root_area = m_nodes[0].bounds.surface_area();
+		double cost = 0;
+		for(const node &node : m_nodes){
+			cost += double(node.bounds.surface_area() / root_area) * (1 + node.count);
+		}
+		return float(cost);
+	}
+
+	size_t num_nodes() const
+	{
+		return m_nodes.size();
+	}
+
+private:
+
+	struct bin{
+		aabb box;
+		uint32_t count;
+	};
+	struct prim_ref{
+		aabb box;
+		uint32_t prim;
+	};
+	struct split{
+		aabb box;       //bounds of node
+		uint32_t mid;   //primitives [begin,mid) are in left child
+		uint16_t axis;  //split axis
+	};
+
+	//nodes with more primitives than this are binned and partitioned in parallel (in chunks of parallel_node_size / 4 primitives)
+	static const size_t parallel_node_size = 1 << 16;
+
+	//evaluate func(i) (0 <= i < n) in chunks in parallel with pool (sequentially if p_pool is nullptr or n is small)
+	template<class Func> static void parallel_for(thread_pool *p_pool, const size_t n, Func func)
+	{
+		const size_t grain = parallel_node_size / 4;
+		const size_t num_chunks = (n + grain - 1) / grain;
+		auto chunk = [&](const size_t c){
+			for(size_t i = c * grain, e = std::min(i + grain, n); i < e; i++){
+				func(i);
+			}
+		};
+		if((p_pool != nullptr) && (num_chunks > 1)){
+			p_pool->run(int(num_chunks), [&](const int c){ chunk(size_t(c)); });
+		}else{
+			for(size_t c = 0; c < num_chunks; c++){
+				chunk(c);
+			}
+		}
+	}
+
+	//return number of bins to split a node of count primitives at depth (0: median split)
+	//the median split halves the node, so that its subtree is at most ceil(log2(count))-1 levels deep below it,
+	//and binned SAH is used only while the subtree could not exceed max_depth even if the children are split at the median
+	static size_t num_split_bins(const size_t B, const size_t depth, const size_t count)
+	{
+		size_t log2_count = 0;
+		while((size_t(1) << log2_count) < count){
+			log2_count++;
+		}
+		return (depth + log2_count < max_depth) ? B : 0;
+	}
+
+	//return bounds, split position and axis of primitives refs[begin,end) and partition them (by all threads of pool if p_pool is not nullptr)
+	//B: number of bins per axis (median split if less than 2)
+	static split split_node(std::vector<prim_ref> &refs, const uint32_t begin, const uint32_t end, const size_t B, thread_pool *p_pool)
+	{
+		const size_t count = end - begin;
+		const size_t grain = parallel_node_size / 4;
+		const size_t num_chunks = (p_pool != nullptr) ? (count + grain - 1) / grain : 1;
+		auto for_chunks = [&](auto func){
+			auto chunk = [&](const size_t c){
+				func(c, begin + uint32_t(c * count / num_chunks), begin + uint32_t((c + 1) * count / num_chunks));
+			};
+			if(num_chunks > 1){
+				p_pool->run(int(num_chunks), [&](const int c){ chunk(size_t(c)); });
+			}else{
+				chunk(0);
+			}
+		};
+
+		//per-chunk bounds and bins (kept by each thread, since most nodes are small)
+		thread_local std::vector<aabb> chunk_boxes_storage;
+		thread_local std::vector<bin> chunk_bins_storage;
+		chunk_boxes_storage.resize(std::max(chunk_boxes_storage.size(), 2 * num_chunks));
+		chunk_bins_storage.resize(std::max(chunk_bins_storage.size(), num_chunks * 3 * B));
+		aabb *chunk_boxes = chunk_boxes_storage.data();
+		bin *chunk_bins = chunk_bins_storage.data();
+
+		//bounds of node and centroids
+		for_chunks([&](const size_t c, const uint32_t b, const uint32_t e){
+			aabb box, centroids;
+			for(uint32_t i = b; i < e; i++){
+				const aabb &pb = refs[i].box;
+				box.expand(pb);
+				centroids.expand(aabb(pb.center(), pb.center()));
+			}
+			chunk_boxes[2 * c] = box;
+			chunk_boxes[2 * c + 1] = centroids;
+		});
+		split result{ aabb(), (begin + end) / 2, 0 };
+		aabb centroids;
+		for(size_t c = 0; c < num_chunks; c++){
+			result.box.expand(chunk_boxes[2 * c]);
+			centroids.expand(chunk_boxes[2 * c + 1]);
+		}
+		if(count <= max_leaf_size){
+			return result;
+		}
+
+		const vec3 cmin = centroids.min();
+		const vec3 extent = centroids.max() - cmin;
+		const int longest = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+		result.axis = uint16_t(longest);
+		if(extent[longest] <= 0){
+			return result; //all centroids are the same
+		}
+
+		//median split (also used if binning finds no split, so that the range is always partitioned at result.mid)
+		auto median_split = [&](){
+			std::nth_element(refs.begin() + begin, refs.begin() + result.mid, refs.begin() + end, [longest](const prim_ref &a, const prim_ref &b){
+				return (a.box.center()[longest] < b.box.center()[longest]);
+			});
+			return result;
+		};
+		if(B < 2){
+			return median_split();
+		}
+
+		//binning of centroids along each axis
+		auto bin_index = [&](const vec3 &c, const int k){
+			return std::min(B - 1, size_t((c[k] - cmin[k]) * (B / extent[k])));
+		};
+		std::fill(chunk_bins, chunk_bins + num_chunks * 3 * B, bin{ aabb(), 0 });
+		for_chunks([&](const size_t c, const uint32_t b, const uint32_t e){
+			bin *bins = &chunk_bins[c * 3 * B];
+			for(uint32_t i = b; i < e; i++){
+				const aabb &pb = refs[i].box;
+				const vec3 center = pb.center();
+				for(int k = 0; k < 3; k++){
+					if(extent[k] > 0){
+						bin &bin = bins[k * B + bin_index(center, k)];
+						bin.box.expand(pb);
+						bin.count++;
+					}
+				}
+			}
+		});
+		for(size_t c = 1; c < num_chunks; c++){
+			for(size_t j = 0; j < 3 * B; j++){
+				chunk_bins[j].box.expand(chunk_bins[c * 3 * B + j].box);
+				chunk_bins[j].count += chunk_bins[c * 3 * B + j].count;
+			}
+		}
+
+		//split minimizing area(left)*count(left)+area(right)*count(right) between bins j and j+1
+		float min_cost = FLT_MAX;
+		int axis = -1;
+		size_t split_bin = 0;
+		for(int k = 0; k < 3; k++){
+			if(extent[k] <= 0){
+				continue;
+			}
+			const bin *bins = &chunk_bins[k * B];
+			float right_cost[max_num_bins];
+			aabb right;
+			uint32_t num_right = 0;
+			for(size_t j = B - 1; j > 0; j--){
+				right.expand(bins[j].box);
+				num_right += bins[j].count;
+				right_cost[j - 1] = (num_right > 0) ? right.surface_area() * num_right : 0;
+			}
+			aabb left;
+			uint32_t num_left = 0;
+			for(size_t j = 0; j + 1 < B; j++){
+				left.expand(bins[j].box);
+				num_left += bins[j].count;
+				if((num_left == 0) || (num_left == count)){
+					continue;
+				}
+				const float cost = left.surface_area() * num_left + right_cost[j];
+				if(cost < min_cost){
+					min_cost = cost; axis = k; split_bin = j;
+				}
+			}
+		}
+		if(axis < 0){
+			return median_split();
+		}
+		result.axis = uint16_t(axis);
+		auto is_left = [&](const prim_ref &ref){
+			return (bin_index(ref.box.center(), axis) <= split_bin);
+		};
+
+		//partition (chunks are partitioned into a temporary array at offsets given by prefix sums of their left and right counts)
+		if(num_chunks == 1){
+			result.mid = uint32_t(std::partition(refs.begin() + begin, refs.begin() + end, is_left) - refs.begin());
+			return result;
+		}
+		std::vector<uint32_t> num_left(num_chunks + 1);
+		for_chunks([&](const size_t c, const uint32_t b, const uint32_t e){
+			num_left[c + 1] = uint32_t(std::count_if(refs.begin() + b, refs.begin() + e, is_left));
+		});
+		for(size_t c = 0; c < num_chunks; c++){
+			num_left[c + 1] += num_left[c];
+		}
+		std::vector<prim_ref> tmp(count);
+		for_chunks([&](const size_t c, const uint32_t b, const uint32_t e){
+			uint32_t l = num_left[c], r = num_left[num_chunks] + (b - begin) - num_left[c];
+			for(uint32_t i = b; i < e; i++){
+				tmp[is_left(refs[i]) ? l++ : r++] = refs[i];
+			}
+		});
+		for_chunks([&](const size_t, const uint32_t b, const uint32_t e){
+			std::copy(tmp.begin() + (b - begin), tmp.begin() + (e - begin), refs.begin() + b);
+		});
+		result.mid = begin + num_left[num_chunks];
+		return result;
+	}
+
+	std::vector<node> m_nodes;     //nodes in breadth-first order
+	std::vector<uint32_t> m_levels; //m_levels[d]: index of first node of depth d (m_levels.back() is number of nodes)
+	std::vector<uint32_t> m_prims;  //primitive indices referenced by leaves
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -73,8 +73,9 @@ public:
 	{
 		const float t = m_focus / lens_wi.cos();
 		const vec3 screen_p = lens_p + vec3(lens_wi) * t;
-		const int pixel_x = int(dot(screen_p - m_screen_min, m_t) * m_res_x / m_screen_size_x);
-		const int pixel_y = int(dot(screen_p - m_screen_min, m_b) * m_res_y / m_screen_size_y);
+		//floor (instead of truncation toward zero), so that points just outside the screen are not counted in pixels (0,y)/(x,0)
+		const int pixel_x = int(std::floor(dot(screen_p - m_screen_min, m_t) * m_res_x / m_screen_size_x));
+		const int pixel_y = int(std::floor(dot(screen_p - m_screen_min, m_b) * m_res_y / m_screen_size_y));
 
 		if((0 <= pixel_x) && (pixel_x < m_res_x)){
 			if((0 <= pixel_y) && (pixel_y < m_res_y)){
@@ -0,0 +1,89 @@
+
+#pragma once
+
+#ifndef COUNT_ALLOCATIONS_HPP
+#define COUNT_ALLOCATIONS_HPP
+
+#include<new>
+#include<cstdlib>
+
+#include"allocation_counter.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//replacement of global operator new/delete to count heap allocations
+//this header defines non-inline functions, so that it must be included in exactly one translation unit (e.g., main.cpp)
+//over-aligned allocations (operator new with std::align_val_t) are not counted
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//count allocation and allocate size bytes with malloc (nullptr on failure)
+//array and scalar forms of operator new allocate through this helper directly instead of calling each other
+//it is not inlined, since GCC would otherwise see malloc() in inlined operator new paired with operator delete (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void *counted_malloc(const size_t size) noexcept
+{
+	num_allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void *operator new(const size_t size)
+{
+	if(void *p = counted_malloc(size)){
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new[](const size_t size)
+{
+	if(void *p = counted_malloc(size)){
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new(const size_t size, const std::nothrow_t&) noexcept
+{
+	return counted_malloc(size);
+}
+
+void *operator new[](const size_t size, const std::nothrow_t&) noexcept
+{
+	return counted_malloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+//sized and nothrow forms forward to the unsized operator delete, so that all memory is freed in one place
+void operator delete(void *p, const size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, const size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+	operator delete(p);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
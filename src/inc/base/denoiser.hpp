@@ -0,0 +1,93 @@
+
+#pragma once
+
+#ifndef DENOISER_HPP
+#define DENOISER_HPP
+
+#include<cmath>
+
+#include"image.hpp"
+#include"parallel.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by feature buffers and variance (as in SVGF)
+//color: image to be denoised, variance: variance of each pixel of color, albedo/normal: first-hit feature buffers
+//num_passes: number of a-trous iterations (filter footprint is 4*2^num_passes+1 pixels)
+inline imagef denoise(const imagef &color, const imagef &variance, const imagef &albedo, const imagef &normal, const int num_passes = 5, const size_t nt = std::thread::hardware_concurrency())
+{
+	//parameters of edge-stopping functions
+	const float sigma_c = 4;      //color (relative to standard deviation)
+	const float sigma_n = 0.1f;   //normal
+	const float sigma_a = 0.1f;   //albedo
+
+	//B3 spline kernel
+	const float kernel[5] = { 1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f, 1 / 16.0f };
+
+	const int w = color.width();
+	const int h = color.height();
+
+	imagef src = color, src_var = variance;
+	imagef dst(w, h), dst_var(w, h);
+
+	for(int pass = 0, step = 1; pass < num_passes; pass++, step *= 2){
+
+		in_parallel(h, [&](const int y)
+		{
+			for(int x = 0; x < w; x++){
+
+				const float *cp = src(x, y);
+				const float *vp = src_var(x, y);
+				const float *np = normal(x, y);
+				const float *ap = albedo(x, y);
+
+				float sum_w = 0, sum_c[3] = {}, sum_v[3] = {};
+				for(int j = -2; j <= 2; j++){
+					const int yq = y + j * step;
+					if((yq < 0) || (yq >= h)){
+						continue;
+					}
+					for(int i = -2; i <= 2; i++){
+						const int xq = x + i * step;
+						if((xq < 0) || (xq >= w)){
+							continue;
+						}
+
+						const float *cq = src(xq, yq);
+						const float *vq = src_var(xq, yq);
+						const float *nq = normal(xq, yq);
+						const float *aq = albedo(xq, yq);
+
+						float dc = 0, dn = 0, da = 0;
+						for(int k = 0; k < 3; k++){
+							dc += (cp[k] - cq[k]) * (cp[k] - cq[k]) / (sigma_c * sigma_c * (vp[k] + vq[k]) + 1e-6f);
+							dn += (np[k] - nq[k]) * (np[k] - nq[k]);
+							da += (ap[k] - aq[k]) * (ap[k] - aq[k]);
+						}
+						const float wq = kernel[i + 2] * kernel[j + 2] * std::exp(-dc - dn / (sigma_n * sigma_n) - da / (sigma_a * sigma_a));
+
+						sum_w += wq;
+						for(int k = 0; k < 3; k++){
+							sum_c[k] += wq * cq[k];
+							sum_v[k] += wq * wq * vq[k];
+						}
+					}
+				}
+				for(int k = 0; k < 3; k++){
+					dst(x, y)[k] = sum_c[k] / sum_w;
+					dst_var(x, y)[k] = sum_v[k] / (sum_w * sum_w);
+				}
+			}
+		}, nt);
+
+		std::swap(src, dst);
+		std::swap(src_var, dst_var);
+	}
+	return src;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
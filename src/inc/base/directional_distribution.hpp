@@ -0,0 +1,108 @@
+
+#pragma once
+
+#ifndef DIRECTIONAL_DISTRIBUTION_HPP
+#define DIRECTIONAL_DISTRIBUTION_HPP
+
+#include<array>
+#include<algorithm>
+
+#include"rng.hpp"
+#include"math.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//directional_distribution
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//piecewise constant distribution on the unit sphere
+//the sphere is divided into NZ x NP bins of equal area using cylindrical mapping (z=cos(theta), phi)
+template<size_t NZ, size_t NP> class directional_distribution
+{
+public:
+
+	directional_distribution() : m_cdf(), m_sum()
+	{
+	}
+
+	//add weight to the bin including direction w (w: unit vector)
+	void add(const vec3 &w, const float weight)
+	{
+		m_cdf[bin(w) + 1] += weight;
+	}
+
+	//add pmf of distribution d multiplied by weight
+	void add(const directional_distribution &d, const float weight)
+	{
+		if(d.is_valid()){
+			for(size_t i = 0; i < NZ * NP; i++){
+				m_cdf[i + 1] += d.pmf(i) * weight;
+			}
+		}
+	}
+
+	//construct cdf from added weights
+	void build()
+	{
+		double sum = 0;
+		for(size_t i = 0; i < NZ * NP; i++){
+			sum += m_cdf[i + 1]; m_cdf[i + 1] = float(sum);
+		}
+		m_sum = float(sum);
+		if(sum > 0){
+			const float inv_sum = float(1 / sum);
+			for(size_t i = 0; i < NZ * NP; i++){
+				m_cdf[i + 1] *= inv_sum;
+			}
+			m_cdf.back() = 1;
+		}
+	}
+
+	//sample direction proportional to the weights
+	vec3 sample(random_number_generator &rng) const
+	{
+		assert(is_valid());
+		const size_t idx = std::min(size_t(std::upper_bound(m_cdf.begin(), m_cdf.end(), rng.generate_uniform_real()) - m_cdf.begin() - 1), NZ * NP - 1);
+		const size_t iz = idx / NP;
+		const size_t ip = idx - NP * iz;
+
+		const float ct = -1 + 2 * (iz + rng.generate_uniform_real()) / NZ;
+		const float ph = -PI() + 2 * PI() * (ip + rng.generate_uniform_real()) / NP;
+		const float st = sqrt(std::max(1 - ct * ct, 0.0f));
+		return vec3(st * cos(ph), st * sin(ph), ct);
+	}
+
+	//return solid angle pdf of direction w
+	float pdf(const vec3 &w) const
+	{
+		return is_valid() ? pmf(bin(w)) * (NZ * NP) / (4 * PI()) : 0;
+	}
+
+	//return false if no weight is added
+	bool is_valid() const
+	{
+		return (m_sum > 0);
+	}
+
+private:
+
+	float pmf(const size_t idx) const
+	{
+		return m_cdf[idx + 1] - m_cdf[idx];
+	}
+
+	static size_t bin(const vec3 &w)
+	{
+		const size_t iz = std::min(size_t(std::max((w.z + 1) * (0.5f * NZ), 0.0f)), NZ - 1);
+		const size_t ip = std::min(size_t(std::max((std::atan2(w.y, w.x) + PI()) * (NP / (2 * PI())), 0.0f)), NP - 1);
+		return ip + NP * iz;
+	}
+
+private:
+
+	std::array<float, NZ * NP + 1> m_cdf;
+	float m_sum;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
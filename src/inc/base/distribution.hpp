@@ -5,55 +5,171 @@
 #define DISTRIBUTION_HPP
 
 #include<vector>
+#include<cassert>
+#include<cstdint>
 #include<algorithm>
 
 #include"rng.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//distribution
+//dynamic_distribution
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-template<class T> class distribution
+//distribution over indices 0,...,n-1 whose weights can be changed individually
+//weights are stored in a binary tree of partial sums, so that set_weight and sample take O(log n) without rebuilding
+class dynamic_distribution
 {
 public:
 
-	//elems: set of elements to construct distribution, weight: function object that returns weight
-	//distribution::sample samples element proportional to weight
-	//distribution::normalization_constant returns sum of weight
-	template<class Weight> distribution(std::vector<T> elems, Weight weight) : m_cdf(elems.size() + 1)
+	//weights: initial weights
+	explicit dynamic_distribution(const std::vector<float> &weights) : m_size(1)
 	{
+		while(m_size < weights.size()){
+			m_size *= 2;
+		}
+		m_sums.assign(2 * m_size, 0);
+		for(size_t i = 0, n = weights.size(); i < n; i++){
+			m_sums[m_size + i] = weights[i];
+		}
+		for(size_t i = m_size - 1; i > 0; i--){
+			m_sums[i] = m_sums[2 * i] + m_sums[2 * i + 1];
+		}
+	}
+	dynamic_distribution() : m_size()
+	{
+	}
+
+	//change weight of idx-th element
+	void set_weight(const size_t idx, const float weight)
+	{
+		assert(idx < m_size);
+		size_t i = m_size + idx;
+		m_sums[i] = weight;
+		for(i /= 2; i > 0; i /= 2){
+			m_sums[i] = m_sums[2 * i] + m_sums[2 * i + 1];
+		}
+	}
+
+	//idx : sampled index, pmf: sampling probability
+	struct sample_t{
+		size_t idx; float pmf;
+	};
+	sample_t sample(random_number_generator &rng) const
+	{
+		float u = rng.generate_uniform_real() * m_sums[1];
+		size_t i = 1;
+		while(i < m_size){
+			//subtrees with zero weight are never chosen
+			if((u < m_sums[2 * i]) || (m_sums[2 * i + 1] <= 0)){
+				i = 2 * i;
+			}else{
+				u -= m_sums[2 * i];
+				i = 2 * i + 1;
+			}
+		}
+		return sample_t{ i - m_size, m_sums[i] / m_sums[1] };
+	}
+
+	//return pmf to sample idx-th element
+	float pmf(const size_t idx) const
+	{
+		return assert(idx < m_size), m_sums[m_size + idx] / m_sums[1];
+	}
+
+	//return sum of weights
+	float normalization_constant() const
+	{
+		return (m_size > 0) ? m_sums[1] : 0;
+	}
+
+private:
+
+	size_t m_size; //number of leaves (power of 2)
+	std::vector<float> m_sums; //m_sums[1]: root, children of node i are 2i and 2i+1, leaves start at m_size
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//distribution_view
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//distribution over elements shared by many distributions (elements are not copied)
+//cdf is stored in external storage, so that cdfs of many distributions can be placed in one array
+//the cdf is stored as n+1 float entries, or quantized: a float base for each block of block_size entries and 16-bit offsets in the block (about half the storage)
+//pmfs are differences of the stored cdf in both formats, so that sampled elements and pmf() are consistent
+template<class T> class distribution_view
+{
+public:
+
+	//number of entries sharing a float base in quantized cdfs
+	static const size_t block_size = 64;
+
+	//return number of floats of storage for cdf of n elements
+	static size_t storage_size(const size_t n, const bool quantized = false)
+	{
+		return quantized ? num_blocks(n) + 1 + (n + 1) / 2 : n + 1;
+	}
+
+	//elems: array of n elements, cdf: storage for storage_size(n, quantized) floats, weight: function object that returns weight
+	template<class Weight> distribution_view(const T *elems, const size_t n, float *cdf, Weight weight, const bool quantized = false) : mp_elems(elems), mp_cdf(cdf), mp_offsets(), m_size(n)
+	{
+		if(quantized){
+			mp_offsets = reinterpret_cast<uint16_t*>(cdf + num_blocks(n) + 1);
+			m_normalization_constant = quantize(weight);
+			return;
+		}
+
 		double sum = 0;
-		for(size_t i = 0, n = elems.size(); i < n; i++){
-			m_cdf[i] = float(sum); sum += weight(elems[i]);
+		for(size_t i = 0; i < n; i++){
+			cdf[i] = float(sum); sum += weight(elems[i]);
 		}
 
 		const float inv_sum = float(1 / sum);
-		for(size_t i = 0, n = elems.size(); i < n; i++){
-			m_cdf[i] *= inv_sum;
+		for(size_t i = 0; i < n; i++){
+			cdf[i] *= inv_sum;
 		}
-		m_cdf.back() = 1;
-		m_elems = std::move(elems);
+		cdf[n] = 1;
 		m_normalization_constant = float(sum);
 	}
-	distribution() : m_normalization_constant()
+	distribution_view() : mp_elems(), mp_cdf(), mp_offsets(), m_size(), m_normalization_constant()
 	{
 	}
 
-
 	//p_elem : address of sampled element, pmf: sampling probability
 	struct sample_t{
 		const T *p_elem; float pmf;
 	};
 	sample_t sample(random_number_generator &rng) const
 	{
-		const size_t idx = std::upper_bound(m_cdf.begin(), m_cdf.end(), rng.generate_uniform_real()) - m_cdf.begin() - 1; //二分探索
-		return sample_t{ &m_elems[idx], m_cdf[idx + 1] - m_cdf[idx] };
+		return sample(rng.generate_uniform_real());
+	}
+
+	//u: uniform number in [0,1)
+	sample_t sample(const float u) const
+	{
+		if(mp_offsets == nullptr){
+			const size_t idx = std::upper_bound(mp_cdf, mp_cdf + m_size + 1, u) - mp_cdf - 1;
+			return sample_t{ &mp_elems[idx], mp_cdf[idx + 1] - mp_cdf[idx] };
+		}
+
+		//block is searched in the bases, and element is searched in the block (only a few cache lines are touched)
+		const size_t nB = num_blocks(m_size);
+		const size_t b = std::min(size_t(std::upper_bound(mp_cdf, mp_cdf + nB + 1, u) - mp_cdf - 1), nB - 1);
+		size_t lo = b * block_size, hi = std::min(lo + block_size, m_size);
+		while(hi - lo > 1){
+			const size_t mid = (lo + hi) / 2;
+			if(cdf(mid) <= u){
+				lo = mid;
+			}else{
+				hi = mid;
+			}
+		}
+		return sample_t{ &mp_elems[lo], cdf(lo + 1) - cdf(lo) };
 	}
 
 	//return pmf to sample idx-th element
 	float pmf(const size_t idx) const
 	{
-		return assert(idx < m_elems.size()), m_cdf[idx + 1] - m_cdf[idx];
+		return assert(idx < m_size), (mp_offsets == nullptr) ? mp_cdf[idx + 1] - mp_cdf[idx] : cdf(idx + 1) - cdf(idx);
 	}
 
 	float normalization_constant() const
@@ -61,27 +177,83 @@ public:
 		return m_normalization_constant;
 	}
 
-	typename std::vector<T>::iterator begin()
+	const T *begin() const
+	{
+		return mp_elems;
+	}
+	const T *end() const
 	{
-		return m_elems.begin();
+		return mp_elems + m_size;
 	}
-	typename std::vector<T>::iterator end()
+
+private:
+
+	static size_t num_blocks(const size_t n)
 	{
-		return m_elems.end();
+		return std::max<size_t>((n + block_size - 1) / block_size, 1);
 	}
-	typename std::vector<T>::const_iterator begin() const
+
+	//return idx-th entry of quantized cdf (base of the block + offset scaled by the span of the block)
+	float cdf(const size_t idx) const
 	{
-		return m_elems.begin();
+		const size_t b = idx / block_size;
+		if((idx % block_size == 0) || (idx == m_size)){
+			return mp_cdf[(idx == m_size) ? num_blocks(m_size) : b];
+		}
+		return mp_cdf[b] + (mp_cdf[b + 1] - mp_cdf[b]) * (mp_offsets[idx] * (1.0f / 65535));
 	}
-	typename std::vector<T>::const_iterator end() const
+
+	//construct quantized cdf and return sum of weights
+	//the offsets of each block partition 65535 units in proportion to the weights, and each element of positive weight gets at least one unit,
+	//so that the relative error of pmfs is bounded by the span of the block instead of the whole cdf
+	template<class Weight> float quantize(Weight weight)
 	{
-		return m_elems.end();
+		const size_t nB = num_blocks(m_size);
+		double sum = 0;
+		for(size_t b = 0; b < nB; b++){
+
+			const size_t begin = b * block_size, n = std::min(block_size, m_size - std::min(begin, m_size));
+			float w[block_size];
+			double block_sum = 0;
+			size_t max_idx = 0;
+			for(size_t i = 0; i < n; i++){
+				w[i] = weight(mp_elems[begin + i]); block_sum += w[i];
+				max_idx = (w[i] > w[max_idx]) ? i : max_idx;
+			}
+			mp_cdf[b] = float(sum); sum += block_sum;
+
+			uint32_t units[block_size];
+			uint32_t num_units = 0;
+			for(size_t i = 0; i < n; i++){
+				units[i] = (w[i] > 0) ? std::max(uint32_t(1), uint32_t(w[i] / block_sum * (65535 - block_size))) : 0;
+				num_units += units[i];
+			}
+			if(num_units > 0){
+				units[max_idx] += 65535 - num_units;
+			}
+			uint32_t offset = 0;
+			for(size_t i = 0; i < n; i++){
+				if(i > 0){
+					mp_offsets[begin + i] = uint16_t(offset);
+				}
+				offset += units[i];
+			}
+		}
+
+		const float inv_sum = float(1 / sum);
+		for(size_t b = 0; b < nB; b++){
+			mp_cdf[b] *= inv_sum;
+		}
+		mp_cdf[nB] = 1;
+		return float(sum);
 	}
 
 private:
 
-	std::vector<T> m_elems;
-	std::vector<float> m_cdf;
+	const T *mp_elems;
+	float *mp_cdf; //cdf entries, or block bases of quantized cdf
+	uint16_t *mp_offsets; //offsets of quantized cdf in blocks (nullptr if cdf is not quantized)
+	size_t m_size;
 	float m_normalization_constant;
 };
 
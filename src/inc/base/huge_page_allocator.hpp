@@ -0,0 +1,126 @@
+
+#pragma once
+
+#ifndef HUGE_PAGE_ALLOCATOR_HPP
+#define HUGE_PAGE_ALLOCATOR_HPP
+
+#include<new>
+#include<cstddef>
+#include<cstdlib>
+
+#include"allocation_counter.hpp"
+
+#if !defined(_WIN32)
+#include<sys/mman.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//huge pages
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//size of huge page (2MB). allocations smaller than this use ordinary memory
+const size_t huge_page_size = size_t(2) << 20;
+
+//flag to enable huge pages (can be disabled to compare TLB misses)
+inline bool use_huge_pages = true;
+
+//return number of bytes actually reserved for allocation of bytes
+inline size_t huge_page_round_up(const size_t bytes)
+{
+	return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+}
+
+//allocate memory backed by 2MB pages
+//explicit huge pages (hugetlbfs pool) are tried first, then transparent huge pages via madvise, then ordinary pages
+//return nullptr on failure
+inline void *allocate_huge_pages(const size_t bytes)
+{
+	//counted as heap allocation (operator new is not used)
+	num_allocations.fetch_add(1, std::memory_order_relaxed);
+#if !defined(_WIN32)
+	const size_t size = huge_page_round_up(bytes);
+	if(use_huge_pages){
+#if defined(MAP_HUGETLB)
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED){
+			return p;
+		}
+#endif
+	}
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		return nullptr;
+	}
+#if defined(MADV_HUGEPAGE)
+	if(use_huge_pages){
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+#endif
+	return p;
+#else
+	return std::malloc(bytes);
+#endif
+}
+
+//release memory allocated by allocate_huge_pages
+inline void deallocate_huge_pages(void *p, const size_t bytes)
+{
+#if !defined(_WIN32)
+	munmap(p, huge_page_round_up(bytes));
+#else
+	(void)bytes, std::free(p);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//huge_page_allocator
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//allocator for large buffers accessed randomly (reduces dTLB misses)
+//allocations of at least huge_page_size bytes are backed by huge pages, smaller ones by operator new
+template<class T> class huge_page_allocator
+{
+public:
+
+	using value_type = T;
+
+	huge_page_allocator() = default;
+	template<class U> huge_page_allocator(const huge_page_allocator<U>&)
+	{
+	}
+
+	T *allocate(const size_t n)
+	{
+		const size_t bytes = n * sizeof(T);
+		if(bytes >= huge_page_size){
+			if(void *p = allocate_huge_pages(bytes)){
+				return static_cast<T*>(p);
+			}
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(::operator new(bytes));
+	}
+
+	void deallocate(T *p, const size_t n)
+	{
+		const size_t bytes = n * sizeof(T);
+		if(bytes >= huge_page_size){
+			deallocate_huge_pages(p, bytes);
+		}else{
+			::operator delete(p);
+		}
+	}
+
+	template<class U> bool operator==(const huge_page_allocator<U>&) const
+	{
+		return true;
+	}
+	template<class U> bool operator!=(const huge_page_allocator<U>&) const
+	{
+		return false;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
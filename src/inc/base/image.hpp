@@ -4,31 +4,90 @@
 #ifndef IMAGE_HPP
 #define IMAGE_HPP
 
+#include<cmath>
 #include<vector>
 #include<string>
 #include<fstream>
+#include<algorithm>
+
+#include"huge_page_allocator.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //forward declaration
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-template<class T> class Image;
+struct scanline_layout;
+struct morton_layout;
+template<class T, class Layout = scanline_layout> class Image;
 using image = Image<unsigned char>;
 using imagef = Image<float>;
 using imaged = Image<double>;
+using imagef_tiled = Image<float, morton_layout>;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//pixel layouts
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//pixels are stored row by row (default)
+struct scanline_layout
+{
+	static size_t size(const int width, const int height)
+	{
+		return size_t(width) * height;
+	}
+	static size_t index(const int x, const int y, const int width)
+	{
+		return x + size_t(width) * y;
+	}
+};
+
+//pixels are stored tile by tile (8x8 pixels, row by row), and in Morton order in each tile (opt-in, e.g., imagef_tiled)
+//a tile (64 pixels of RGB float) occupies 12 cache lines, so that accesses to a small screen region touch few cache lines
+//the image is padded to multiples of the tile size. use to_scanline to convert the image for output
+//(bench_splat compares splatting into and accumulating from both layouts)
+struct morton_layout
+{
+	static const int tile_size = 8;
+
+	static size_t size(const int width, const int height)
+	{
+		return size_t(num_tiles(width)) * num_tiles(height) * (tile_size * tile_size);
+	}
+	static size_t index(const int x, const int y, const int width)
+	{
+		//Morton order in a tile (table lookup is faster than bit interleaving)
+		static const unsigned char morton[tile_size * tile_size] = {
+			 0,  1,  4,  5, 16, 17, 20, 21,
+			 2,  3,  6,  7, 18, 19, 22, 23,
+			 8,  9, 12, 13, 24, 25, 28, 29,
+			10, 11, 14, 15, 26, 27, 30, 31,
+			32, 33, 36, 37, 48, 49, 52, 53,
+			34, 35, 38, 39, 50, 51, 54, 55,
+			40, 41, 44, 45, 56, 57, 60, 61,
+			42, 43, 46, 47, 58, 59, 62, 63,
+		};
+		const unsigned int ux = x, uy = y;
+		const size_t tile = (ux / tile_size) + size_t(num_tiles(width)) * (uy / tile_size);
+		return tile * (tile_size * tile_size) + morton[(ux % tile_size) + tile_size * (uy % tile_size)];
+	}
+	static unsigned int num_tiles(const int n)
+	{
+		return (unsigned(n) + tile_size - 1) / tile_size;
+	}
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //Image
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-template<class T> class Image
+template<class T, class Layout> class Image
 {
 public:
 
 	Image() : m_width(), m_height(), m_data()
 	{
 	}
-	Image(const int width, const int height) : m_width(width), m_height(height), m_data(3 * width * height)
+	Image(const int width, const int height) : m_width(width), m_height(height), m_data(3 * Layout::size(width, height))
 	{
 	}
 
@@ -41,23 +100,125 @@ public:
 		return m_height;
 	}
 
+	//return index of pixel (x,y) in storage order (pixel (x,y) is data() + 3 * index(x,y))
+	size_t index(const int x, const int y) const
+	{
+		return Layout::index(x, y, m_width);
+	}
+
+	//return number of elements including padding (3 * number of pixels in storage)
+	size_t size() const
+	{
+		return m_data.size();
+	}
+
+	T *data()
+	{
+		return m_data.data();
+	}
+	const T *data() const
+	{
+		return m_data.data();
+	}
+
 	T *operator()(const int x, const int y)
 	{
-		return &m_data[3 * (x + m_width * y)];
+		return &m_data[3 * index(x, y)];
 	}
 	const T *operator()(const int x, const int y) const
 	{
-		return &m_data[3 * (x + m_width * y)];
+		return &m_data[3 * index(x, y)];
 	}
 
 private:
 	
 	int m_width;
 	int m_height;
-	std::vector<T> m_data;
+	std::vector<T, huge_page_allocator<T>> m_data;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//convert tiled image to scanline order
+//output is written sequentially (reads stay in a row of tiles, i.e., 8 rows of the image)
+template<class T> Image<T> to_scanline(const Image<T, morton_layout> &img)
+{
+	const int width = img.width();
+	const int height = img.height();
+
+	Image<T> result(width, height);
+	T *dst = result.data();
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < width; x++, dst += 3){
+			const T *src = img(x, y);
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		}
+	}
+	return result;
+}
+
+//return RMS error of the mean of n images estimated from the variance between them at each element
+//sum/sum2: sums of the images and of their squares (size elements), relative_error: RMS error relative to the mean element
+//(0 if n < 2)
+inline double estimate_rmse(const double *sum, const double *sum2, const size_t size, const size_t n, double &relative_error)
+{
+	relative_error = 0;
+	if(n < 2){
+		return 0;
+	}
+	double sum_var = 0, sum_mean = 0;
+	for(size_t i = 0; i < size; i++){
+		const double m = sum[i] / n;
+		sum_var += std::max(sum2[i] / n - m * m, 0.0) / (n - 1);
+		sum_mean += m;
+	}
+	const double error = std::sqrt(sum_var / size);
+	relative_error = (sum_mean > 0) ? error / (sum_mean / size) : 0;
+	return error;
+}
+
+//return RMS error of the mean of n images relative to reference (sum: sum of the images with the resolution of reference)
+inline double calc_rmse(const double *sum, const size_t n, const imagef &reference)
+{
+	const size_t size = reference.size();
+	double sum_se = 0;
+	for(size_t i = 0; i < size; i++){
+		const double d = sum[i] / n - reference.data()[i];
+		sum_se += d * d;
+	}
+	return std::sqrt(sum_se / size);
+}
 
+//save as portable float map (linear RGB, rows from bottom to top as in bitmap)
+inline void save_as_pfm(const imagef &img, const std::string &filename)
+{
+	std::ofstream ofs(filename, std::ios::binary);
+	ofs << "PF\n" << img.width() << " " << img.height() << "\n-1.0\n"; //negative scale: little endian
+	ofs.write((const char*)img.data(), sizeof(float) * img.size());
+}
+
+//load portable float map saved by save_as_pfm (empty image if the file cannot be read)
+inline imagef load_pfm(const std::string &filename)
+{
+	std::ifstream ifs(filename, std::ios::binary);
+	std::string type;
+	int width = 0, height = 0;
+	float scale = 0;
+	if(!(ifs >> type >> width >> height >> scale) || (type != "PF") || (width <= 0) || (height <= 0) || (scale >= 0)){
+		return imagef();
+	}
+	ifs.get(); //single whitespace after header
+
+	imagef img(width, height);
+	if(!ifs.read((char*)img.data(), sizeof(float) * img.size())){
+		return imagef();
+	}
+	return img;
+}
 
 //save as bitmap
 inline void save_as_bmp(const image &img, const std::string &filename)
@@ -5,8 +5,22 @@
 #define KD_TREE_HPP
 
 #include<queue>
+#include<chrono>
 #include<vector>
 #include"math.hpp"
+#include"ray_counter.hpp"
+#include"huge_page_allocator.hpp"
+#include"allocation_counter.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//kNN lookup counter
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//number of kNN lookups (find_nearest) and time of sampled lookups in nanoseconds
+//every knn_sample_interval-th lookup of each thread is timed, so that knn_sampled_nanoseconds * knn_sample_interval estimates the time of all lookups
+const uint32_t knn_sample_interval = 64;
+inline sharded_counter num_knn_lookups;
+inline sharded_counter knn_sampled_nanoseconds;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //neighbor
@@ -67,8 +81,19 @@ public:
 	};
 
 	//elems: set of elements, point: function object that returns position
-	template<class Point> kd_tree(std::vector<T> elems, Point point) : m_nodes(elems.size())
+	template<class Point> kd_tree(std::vector<T> elems, Point point)
 	{
+		build(elems, point);
+	}
+	kd_tree() = default;
+
+	//rebuild tree from elems reusing memory of nodes (elements are moved from elems)
+	template<class Point> void build(std::vector<T> &elems, Point point)
+	{
+		m_nodes.clear();
+		reserve_with_headroom(m_nodes, elems.size());
+		m_nodes.resize(elems.size());
+
 		auto implement = [&](const size_t idx, auto first, auto last, const int depth, auto *This) -> void
 		{
 			const size_t num = last - first;
@@ -94,13 +119,19 @@ public:
 				}
 			}
 		};
-		implement(0, elems.begin(), elems.end(), 0, &implement);
+		if(!elems.empty()){
+			implement(0, elems.begin(), elems.end(), 0, &implement);
+		}
 	}
-	kd_tree() = default;
 
 	//p: query point, r: query radius, n: number of elements, neighbors: store neighbor elements
 	void find_nearest(const vec3 &p, const float r, const size_t n, std::vector<neighbor<T>> &neighbors) const
 	{
+		thread_local uint32_t num_lookups = 0;
+		const bool timed = ((num_lookups++ % knn_sample_interval) == 0);
+		const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+		num_knn_lookups.add(1);
+
 		float r2 = r * r;
 		auto implement = [&, p, n, this](const size_t idx, auto *This) -> void
 		{
@@ -149,20 +180,56 @@ public:
 		if(neighbors.size() < n){
 			std::make_heap(neighbors.begin(), neighbors.end(), [](const auto &a, const auto &b){ return (a.d2() < b.d2()); });
 		}
+
+		if(timed){
+			knn_sampled_nanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+	}
+
+	//p: query point, r: query radius, func: function object called as func(elem, d2) for all elements within r (in no particular order)
+	template<class Func> void for_each_in_radius(const vec3 &p, const float r, Func func) const
+	{
+		const float r2 = r * r;
+		auto implement = [&, p, this](const size_t idx, auto *This) -> void
+		{
+			if(idx >= m_nodes.size()){
+				return;
+			}
+			const node &node = m_nodes[idx];
+
+			const vec3 diff(
+				p - node.p
+			);
+			if(2 * idx + 1 < m_nodes.size()){
+				const float diff_k = diff[node.k];
+				if((diff_k < 0) || (diff_k * diff_k < r2)){
+					(*This)(2 * idx + 1, This);
+				}
+				if((diff_k >= 0) || (diff_k * diff_k < r2)){
+					(*This)(2 * idx + 2, This);
+				}
+			}
+
+			const float d2 = squared_norm(diff);
+			if(d2 < r2){
+				func(static_cast<const T&>(node), d2);
+			}
+		};
+		implement(0, &implement);
 	}
 
-	typename std::vector<node>::const_iterator begin() const
+	typename std::vector<node, huge_page_allocator<node>>::const_iterator begin() const
 	{
 		return m_nodes.begin();
 	}
-	typename std::vector<node>::const_iterator end() const
+	typename std::vector<node, huge_page_allocator<node>>::const_iterator end() const
 	{
 		return m_nodes.end();
 	}
 
 private:
 
-	std::vector<node> m_nodes;
+	std::vector<node, huge_page_allocator<node>> m_nodes; //nodes are accessed randomly during kNN queries
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,182 @@
+
+#pragma once
+
+#ifndef MAPPED_ARRAY_HPP
+#define MAPPED_ARRAY_HPP
+
+#include<new>
+#include<string>
+#include<cassert>
+#include<algorithm>
+#include<iostream>
+#include<type_traits>
+
+#include"huge_page_allocator.hpp"
+
+#if !defined(_WIN32)
+#include<cstdlib>
+#include<unistd.h>
+#include<sys/mman.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//mapped_array
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//array of trivially copyable elements backed by anonymous memory (huge pages if available) or by a memory-mapped scratch file
+//scratch files allow arrays larger than RAM (pages are written back to the file by the OS)
+//memory is reused if the requested size does not exceed the capacity
+template<class T> class mapped_array
+{
+	static_assert(std::is_trivially_copyable<T>::value, "mapped_array requires trivially copyable elements");
+
+public:
+
+	mapped_array() : mp_data(), m_size(), m_capacity(), m_is_file(), m_filename()
+	{
+	}
+	mapped_array(const mapped_array&) = delete;
+	mapped_array &operator=(const mapped_array&) = delete;
+	~mapped_array()
+	{
+		release();
+	}
+
+	//n: number of elements, filename: path of scratch file (anonymous memory is used if empty)
+	//a unique suffix is appended to the path (mkstemp), so that concurrent processes using the same path do not share the file
+	//contents are undefined after allocation
+	//if mapping the file fails, anonymous memory is used and reused for later requests of the same path
+	//throw std::bad_alloc if anonymous memory cannot be allocated either (the array is left empty)
+	void allocate(const size_t n, const std::string &filename = std::string())
+	{
+		if((n <= m_capacity) && (mp_data != nullptr) && (m_filename == filename)){
+			m_size = n; return;
+		}
+		release();
+
+		const size_t bytes = std::max(n, size_t(1)) * sizeof(T);
+#if !defined(_WIN32)
+		if(!filename.empty()){
+
+			//the file is unlinked immediately, so that it is removed when the mapping is released
+			std::string path = filename + ".XXXXXX";
+			const int fd = mkstemp(&path[0]);
+			if((fd >= 0) && (unlink(path.c_str()) == 0) && (ftruncate(fd, off_t(bytes)) == 0)){
+				void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if(p != MAP_FAILED){
+					mp_data = static_cast<T*>(p); m_is_file = true;
+				}
+			}
+			if(fd >= 0){
+				close(fd);
+			}
+			if(mp_data == nullptr){
+				std::cerr << "mapped_array: failed to map " << filename << ", anonymous memory is used" << std::endl;
+			}
+		}
+#endif
+		size_t capacity = bytes;
+		if(mp_data == nullptr){
+			//anonymous memory is backed by huge pages if available
+			//(allocate_huge_pages falls back to ordinary pages by itself, so nullptr means that memory is exhausted)
+			mp_data = static_cast<T*>(allocate_huge_pages(bytes));
+			capacity = huge_page_round_up(bytes);
+			if(mp_data == nullptr){
+				throw std::bad_alloc();
+			}
+		}
+		m_size = n;
+		m_capacity = capacity / sizeof(T);
+		m_filename = filename;
+	}
+
+	//hint that elements will be accessed sequentially/randomly
+	void advise_sequential()
+	{
+#if !defined(_WIN32)
+		if(mp_data != nullptr){
+			madvise(mp_data, m_capacity * sizeof(T), MADV_SEQUENTIAL);
+		}
+#endif
+	}
+	void advise_random()
+	{
+#if !defined(_WIN32)
+		if(mp_data != nullptr){
+			madvise(mp_data, m_capacity * sizeof(T), MADV_RANDOM);
+		}
+#endif
+	}
+
+	//return pages beyond size() to the OS (e.g., after the array shrank to meet a memory budget)
+	//the capacity is kept, and the released pages are read as zero when the array grows again
+	void release_unused()
+	{
+#if !defined(_WIN32)
+		const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+		const size_t begin = (m_size * sizeof(T) + page_size - 1) / page_size * page_size;
+		const size_t end = m_capacity * sizeof(T);
+		if((mp_data != nullptr) && (begin < end)){
+			madvise(reinterpret_cast<char*>(mp_data) + begin, end - begin, MADV_DONTNEED);
+		}
+#endif
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	//return true if the array is backed by a scratch file
+	bool is_file() const
+	{
+		return m_is_file;
+	}
+
+	T *data()
+	{
+		return mp_data;
+	}
+	const T *data() const
+	{
+		return mp_data;
+	}
+
+	T &operator[](const size_t i)
+	{
+		return assert(i < m_size), mp_data[i];
+	}
+	const T &operator[](const size_t i) const
+	{
+		return assert(i < m_size), mp_data[i];
+	}
+
+private:
+
+	void release()
+	{
+		if(mp_data != nullptr){
+#if !defined(_WIN32)
+			if(m_is_file){
+				munmap(mp_data, m_capacity * sizeof(T));
+			}else
+#endif
+			{
+				deallocate_huge_pages(mp_data, m_capacity * sizeof(T));
+			}
+		}
+		mp_data = nullptr; m_size = m_capacity = 0; m_is_file = false; m_filename.clear();
+	}
+
+private:
+
+	T *mp_data;
+	size_t m_size;
+	size_t m_capacity;
+	bool m_is_file;
+	std::string m_filename; //requested scratch file (kept if anonymous memory is used instead)
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
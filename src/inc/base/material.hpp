@@ -143,6 +143,12 @@ public:
 		return assert(is_emissive()), m_col;
 	}
 
+	//return reflectance (white for light sources)
+	col3 albedo() const
+	{
+		return is_emissive() ? col3(1) : m_col;
+	}
+
 	bool is_emissive() const
 	{
 		return m_is_emissive;
@@ -0,0 +1,43 @@
+
+#pragma once
+
+#ifndef MORTON_HPP
+#define MORTON_HPP
+
+#include<cstdint>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//insert two zero bits between each of the lower 10 bits of x
+inline uint32_t morton_part1by2(uint32_t x)
+{
+	x &= 0x000003ff;
+	x = (x | (x << 16)) & 0xff0000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+//3D Morton code of lower 10 bits of x, y, z (x in bits 3k, y in bits 3k+1, z in bits 3k+2)
+inline uint32_t morton_encode(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+	return morton_part1by2(x) | (morton_part1by2(y) << 1) | (morton_part1by2(z) << 2);
+}
+
+//6D Morton code from two 3D Morton codes of 10 bits per axis (each group of 3 bits of a is placed above the corresponding group of b)
+inline uint64_t morton_interleave3(const uint32_t a, const uint32_t b)
+{
+	uint64_t code = 0;
+	for(int k = 0; k < 10; k++){
+		code |= uint64_t((a >> (3 * k)) & 7) << (6 * k + 3);
+		code |= uint64_t((b >> (3 * k)) & 7) << (6 * k);
+	}
+	return code;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
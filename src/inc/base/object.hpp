@@ -35,12 +35,29 @@ public:
 		return m_sph.intersect(r.o(), r.d(), t_max, r.t_min());
 	}
 
+	//intersection test of n rays from the same origin o (see sphere::intersect)
+	void intersect(const vec3 &o, const float *dx, const float *dy, const float *dz, const float *t_max, const float t_min, const size_t n, bool *occluded) const
+	{
+		m_sph.intersect(o, dx, dy, dz, t_max, t_min, n, occluded);
+	}
+
 	sample_point sample(random_number_generator &rng) const
 	{
 		sample_point sample = m_sph.sample(rng);
 		return sample_point(sample.p(), sample.n(), &m_mtl, sample.pdf());
 	}
 
+	const sphere &shape() const
+	{
+		return m_sph;
+	}
+
+	//change shape (e.g., for moving objects)
+	void set_shape(const sphere &sph)
+	{
+		m_sph = sph;
+	}
+
 	float light_power() const
 	{
 		return m_mtl.is_emissive() ? luminance(m_mtl.Me()) * m_sph.area() : 0;
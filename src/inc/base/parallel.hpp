@@ -8,6 +8,9 @@
 #include<thread>
 #include<vector>
 #include<atomic>
+#include<algorithm>
+#include<type_traits>
+#include<condition_variable>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //spinlock
@@ -33,6 +36,116 @@ private:
 	std::atomic_flag m_state = ATOMIC_FLAG_INIT;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//thread_pool
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//persistent worker threads for loops executed every iteration
+//unlike in_parallel, no thread is created and no memory is allocated per loop
+//(thread_local objects of the workers are also kept between loops)
+class thread_pool
+{
+public:
+
+	explicit thread_pool(const size_t nt = std::thread::hardware_concurrency()) : mp_func(), mp_invoke(), m_n(), m_idx(), m_generation(), m_num_working(), m_stop()
+	{
+		m_threads.reserve(std::max(nt, size_t(1)));
+		for(size_t i = 0; i < std::max(nt, size_t(1)); i++){
+			m_threads.emplace_back([this](){ worker(); });
+		}
+	}
+	thread_pool(const thread_pool&) = delete;
+	thread_pool &operator=(const thread_pool&) = delete;
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_stop = true;
+		}
+		m_cv_start.notify_all();
+		for(auto &thread : m_threads){
+			thread.join();
+		}
+	}
+
+	size_t num_threads() const
+	{
+		return m_threads.size();
+	}
+
+	//evaluate func(i) (0 <= i < n) in parallel and wait for completion
+	template<class Func> void run(const int n, Func &&func)
+	{
+		using F = std::remove_reference_t<Func>;
+		dispatch(n, const_cast<void*>(static_cast<const void*>(&func)), [](void *p, const int i){
+			(*static_cast<F*>(p))(i);
+		});
+	}
+
+	//evaluate func(x, y) (0 <= x < nx, 0 <= y < ny) in parallel and wait for completion
+	template<class Func> void run(const int nx, const int ny, Func &&func)
+	{
+		run(nx * ny, [&](const int i){
+			const int y = i / nx;
+			const int x = i - nx * y;
+			func(x, y);
+		});
+	}
+
+private:
+
+	void dispatch(const int n, void *p_func, void (*p_invoke)(void*, int))
+	{
+		std::unique_lock<std::mutex> lock(m_mtx);
+		mp_func = p_func;
+		mp_invoke = p_invoke;
+		m_n = n;
+		m_idx = 0;
+		m_num_working = m_threads.size();
+		m_generation++;
+		m_cv_start.notify_all();
+		m_cv_done.wait(lock, [this](){ return (m_num_working == 0); });
+	}
+
+	void worker()
+	{
+		size_t generation = 0;
+		while(true){
+			{
+				std::unique_lock<std::mutex> lock(m_mtx);
+				m_cv_start.wait(lock, [&](){ return m_stop || (m_generation != generation); });
+				if(m_stop){
+					return;
+				}
+				generation = m_generation;
+			}
+			for(int i = m_idx.fetch_add(1); i < m_n; i = m_idx.fetch_add(1)){
+				mp_invoke(mp_func, i);
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_mtx);
+				if(--m_num_working == 0){
+					m_cv_done.notify_one();
+				}
+			}
+		}
+	}
+
+private:
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mtx;
+	std::condition_variable m_cv_start; //notified when a loop is dispatched (or the pool is destroyed)
+	std::condition_variable m_cv_done;  //notified when all workers finish the loop
+	void *mp_func;
+	void (*mp_invoke)(void*, int);
+	int m_n;
+	std::atomic<int> m_idx;
+	size_t m_generation;
+	size_t m_num_working;
+	bool m_stop;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //function definitions
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,96 @@
+
+#pragma once
+
+#ifndef PERF_COUNTER_HPP
+#define PERF_COUNTER_HPP
+
+#include<cstdint>
+#include<cstring>
+
+#if defined(__linux__)
+#include<unistd.h>
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+#include<linux/perf_event.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//perf_counter
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//hardware event counter of this process (including threads created after construction) using perf_event_open
+//is_valid() returns false if the event is not supported (e.g., non-Linux systems, VMs, or perf_event_paranoid)
+class perf_counter
+{
+public:
+
+	enum event_t{
+		dtlb_load_misses, //dTLB read misses
+		page_faults,
+		none,             //no event is counted (is_valid() returns false)
+	};
+
+	perf_counter(const event_t event) : m_fd(-1)
+	{
+#if defined(__linux__)
+		if(event == none){
+			return;
+		}
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		if(event == dtlb_load_misses){
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		}else{
+			attr.type = PERF_TYPE_SOFTWARE;
+			attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+		}
+		m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		if(m_fd >= 0){
+			ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#else
+		(void)event;
+#endif
+	}
+	perf_counter(const perf_counter&) = delete;
+	perf_counter &operator=(const perf_counter&) = delete;
+	~perf_counter()
+	{
+#if defined(__linux__)
+		if(m_fd >= 0){
+			close(m_fd);
+		}
+#endif
+	}
+
+	bool is_valid() const
+	{
+		return (m_fd >= 0);
+	}
+
+	//return number of events since construction
+	uint64_t read() const
+	{
+		uint64_t count = 0;
+#if defined(__linux__)
+		if((m_fd >= 0) && (::read(m_fd, &count, sizeof(count)) != sizeof(count))){
+			count = 0;
+		}
+#endif
+		return count;
+	}
+
+private:
+
+	int m_fd;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,90 @@
+
+#pragma once
+
+#ifndef PROMETHEUS_HPP
+#define PROMETHEUS_HPP
+
+#include<string>
+#include<cstdio>
+#include<cstdint>
+#include<sstream>
+#include<fstream>
+
+#if !defined(_WIN32)
+#include<unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//prometheus_writer
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//writer of metrics in Prometheus text exposition format (e.g., for the textfile collector of node_exporter)
+//usage: family("name", "gauge", "help"); sample(value, "label=\"a\""); ... write(filename);
+class prometheus_writer
+{
+public:
+
+	prometheus_writer()
+	{
+		m_text.precision(15);
+	}
+
+	//start metric family name of type ("counter" or "gauge")
+	void family(const std::string &name, const char *type, const char *help)
+	{
+		m_name = name;
+		m_text << "# HELP " << name << " " << help << "\n";
+		m_text << "# TYPE " << name << " " << type << "\n";
+	}
+
+	//add sample of current family with labels (e.g., "stage=\"pmfs\"", no labels if empty)
+	void sample(const double value, const std::string &labels = std::string())
+	{
+		m_text << m_name;
+		if(!labels.empty()){
+			m_text << "{" << labels << "}";
+		}
+		m_text << " " << value << "\n";
+	}
+
+	//write metrics to filename
+	//metrics are written to filename.tmp and renamed, so that scrapers never read a partially written file
+	bool write(const std::string &filename) const
+	{
+		const std::string tmp = filename + ".tmp";
+		{
+			std::ofstream ofs(tmp);
+			ofs << m_text.str();
+			if(!ofs){
+				return false;
+			}
+		}
+		return (std::rename(tmp.c_str(), filename.c_str()) == 0);
+	}
+
+private:
+
+	std::string m_name;
+	std::ostringstream m_text;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//function definitions
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return resident memory of this process in bytes (0 if not available)
+inline uint64_t resident_memory_bytes()
+{
+#if defined(__linux__)
+	std::ifstream ifs("/proc/self/statm");
+	uint64_t size = 0, resident = 0;
+	if(ifs >> size >> resident){
+		return resident * uint64_t(sysconf(_SC_PAGESIZE));
+	}
+#endif
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
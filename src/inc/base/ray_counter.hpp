@@ -0,0 +1,106 @@
+
+#pragma once
+
+#ifndef RAY_COUNTER_HPP
+#define RAY_COUNTER_HPP
+
+#include<atomic>
+#include<cstdint>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//sharded_counter
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//counter incremented by many threads without contention or atomic read-modify-write operations
+//each of the first num_shards threads owns a shard (cache line) and updates it with relaxed load/store,
+//the other threads share an overflow shard updated by fetch_add, and value() sums all shards
+class sharded_counter
+{
+public:
+
+	static const size_t num_shards = 64;
+
+	void add(const uint64_t n)
+	{
+		const size_t idx = thread_index();
+		if(idx < num_shards){
+			std::atomic<uint64_t> &value = m_shards[idx].value;
+			value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}else{
+			m_overflow.value.fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+
+	//return sum of all shards (increments in progress by other threads may be missed)
+	uint64_t value() const
+	{
+		uint64_t sum = m_overflow.value.load(std::memory_order_relaxed);
+		for(const shard &s : m_shards){
+			sum += s.value.load(std::memory_order_relaxed);
+		}
+		return sum;
+	}
+
+	//return value of the shard of calling thread (e.g., for measuring the increments by the thread in a scope)
+	//0 for the threads sharing the overflow shard
+	uint64_t thread_value() const
+	{
+		const size_t idx = thread_index();
+		return (idx < num_shards) ? m_shards[idx].value.load(std::memory_order_relaxed) : 0;
+	}
+
+private:
+
+	//index of calling thread (threads are numbered in order of their first call, and indices are not reused)
+	static size_t thread_index()
+	{
+		static std::atomic<size_t> num_threads(0);
+		thread_local const size_t idx = num_threads.fetch_add(1, std::memory_order_relaxed);
+		return idx;
+	}
+
+	struct alignas(64) shard{
+		std::atomic<uint64_t> value{ 0 };
+	};
+	shard m_shards[num_shards];
+	shard m_overflow;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//ray counter
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//number of rays traced in scenes (closest-hit rays and shadow rays for visibility tests)
+inline sharded_counter num_closest_hit_rays;
+inline sharded_counter num_shadow_rays;
+
+struct ray_count{
+	uint64_t closest_hit;
+	uint64_t shadow;
+};
+
+//add number of rays traced in the scope to count (e.g., for each stage of an iteration)
+class ray_scope
+{
+public:
+
+	explicit ray_scope(ray_count &count) : m_count(count), m_start{ num_closest_hit_rays.value(), num_shadow_rays.value() }
+	{
+	}
+	ray_scope(const ray_scope&) = delete;
+	ray_scope &operator=(const ray_scope&) = delete;
+	~ray_scope()
+	{
+		m_count.closest_hit += num_closest_hit_rays.value() - m_start.closest_hit;
+		m_count.shadow += num_shadow_rays.value() - m_start.shadow;
+	}
+
+private:
+
+	ray_count &m_count;
+	ray_count m_start;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
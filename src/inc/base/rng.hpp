@@ -4,6 +4,7 @@
 #ifndef RANDOM_NUMBER_GENERATOR_HPP
 #define RANDOM_NUMBER_GENERATOR_HPP
 
+#include<cfloat>
 #include<random>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -4,6 +4,8 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include"bvh.hpp"
+#include"ray_counter.hpp"
 #include"object.hpp"
 #include"distribution.hpp"
 
@@ -15,42 +17,98 @@ class scene
 {
 public:
 
-	scene(std::vector<object> objs)
+	//scenes with at most this number of objects are tested without the acceleration structure
+	//(e.g., for the Cornell box made of large spheres, whose bounding boxes contain the whole scene)
+	static const size_t max_linear_objects = 16;
+
+	scene(std::vector<object> objs) : m_objs(std::move(objs))
 	{
 		//construct distribution to sample points on light sources
-		m_objs = distribution<object>(std::move(objs), [](const object &obj){ return obj.light_power(); });
+		std::vector<float> powers(m_objs.size());
+		for(size_t i = 0, n = m_objs.size(); i < n; i++){
+			powers[i] = m_objs[i].light_power();
+		}
+		m_lights = dynamic_distribution(powers);
+
+		//construct acceleration structure
+		m_bvh.build(m_objs.size(), [&](const size_t i){ return m_objs[i].shape().bounds(); });
 	}
 
+	//scene is not copied, since intersections refer to materials of objects
+	scene(const scene&) = delete;
+	scene &operator=(const scene&) = delete;
+
 	//calculate intersection
 	intersection calc_intersection(ray &r) const
 	{
+		num_closest_hit_rays.add(1);
+
 		intersection isect;
-		for(const auto &obj : m_objs){
-			obj.calc_intersection(r, isect);
+		if(m_objs.size() <= max_linear_objects){
+			for(const auto &obj : m_objs){
+				obj.calc_intersection(r, isect);
+			}
+			return isect;
 		}
+		m_bvh.traverse(r.o(), r.d(), r.t_min(), r.t(), [&](const size_t i){
+			m_objs[i].calc_intersection(r, isect); return false;
+		});
 		return isect;
 	}
 
 	//visibility test
 	bool intersect(const ray &r) const
 	{
+		num_shadow_rays.add(1);
+
 		const ray r_(r.o(), r.d(), r.t() * (1 - 1e-3f));
-		for(const auto &obj : m_objs){
-			if(obj.intersect(r_)){
-				return true;
+		if(m_objs.size() <= max_linear_objects){
+			for(const auto &obj : m_objs){
+				if(obj.intersect(r_)){
+					return true;
+				}
 			}
+			return false;
 		}
-		return false;
+		return m_bvh.traverse(r_.o(), r_.d(), r_.t_min(), r_.t(), [&](const size_t i){
+			return m_objs[i].intersect(r_);
+		});
+	}
+
+	//visibility test of n rays from the same origin o (d: unit directions (SoA), t_max: distances shortened to exclude target points)
+	//occluded[i] is set to true if ray i is occluded
+	//objects visited by any of the rays are tested for all rays at once, so that each object is loaded once for all rays
+	void intersect(const vec3 &o, const float *dx, const float *dy, const float *dz, const float *t_max, const size_t n, bool *occluded) const
+	{
+		num_shadow_rays.add(n);
+
+		std::fill(occluded, occluded + n, false);
+		if(m_objs.size() <= max_linear_objects){
+			for(const auto &obj : m_objs){
+				obj.intersect(o, dx, dy, dz, t_max, 1e-3f, n, occluded);
+			}
+			return;
+		}
+
+		bool active[64];
+		assert(n <= 64);
+		std::fill(active, active + n, true);
+		m_bvh.traverse(o, dx, dy, dz, 1e-3f, t_max, active, n, [&](const size_t i){
+			m_objs[i].intersect(o, dx, dy, dz, t_max, 1e-3f, n, occluded);
+			for(size_t k = 0; k < n; k++){
+				active[k] = !occluded[k];
+			}
+		});
 	}
 
 	//point sampling of light sources in the scene
 	sample_point sample_light(random_number_generator &rng) const
 	{
 		//sample sphere proportional to areaxflux
-		const auto s1 = m_objs.sample(rng);
+		const auto s1 = m_lights.sample(rng);
 
 		//uniformly sampling point on sphere
-		const sample_point s2 = s1.p_elem->sample(rng);
+		const sample_point s2 = m_objs[s1.idx].sample(rng);
 
 		const float pdf = s1.pmf * s2.pdf();
 		return sample_point(s2.p(), s2.n(), &s2.material(), pdf);
@@ -59,12 +117,48 @@ public:
 	//calculate pdf of intersection point x
 	float pdf_light(const intersection &x) const
 	{
-		return luminance(x.material().Me()) / m_objs.normalization_constant();
+		return luminance(x.material().Me()) / m_lights.normalization_constant();
+	}
+
+	//return number of objects
+	size_t num_objects() const
+	{
+		return m_objs.size();
+	}
+
+	//return idx-th object
+	const object &operator[](const size_t idx) const
+	{
+		return m_objs[idx];
+	}
+
+	//change shape of idx-th object in place (e.g., moving objects between frames)
+	//the light pmf is updated immediately in O(log n), and the acceleration structure is updated by refit()
+	void set_sphere(const size_t idx, const sphere &sph)
+	{
+		m_objs[idx].set_shape(sph);
+		m_lights.set_weight(idx, m_objs[idx].light_power());
+	}
+
+	//update bounds of acceleration structure bottom-up after set_sphere (in parallel if pool is given)
+	//the tree topology is kept, so that rebuild() should be called if objects moved far from their initial positions
+	void refit(thread_pool *p_pool = nullptr)
+	{
+		m_bvh.refit([&](const size_t i){ return m_objs[i].shape().bounds(); }, p_pool);
+	}
+
+	//rebuild acceleration structure from current objects (in parallel if pool is given)
+	//num_bins: number of bins of binned SAH (fewer bins for faster builds, 0 or 1 for median split)
+	void rebuild(thread_pool *p_pool = nullptr, const size_t num_bins = bvh::default_num_bins)
+	{
+		m_bvh.build(m_objs.size(), [&](const size_t i){ return m_objs[i].shape().bounds(); }, p_pool, num_bins);
 	}
 
 private:
 
-	distribution<object> m_objs;
+	std::vector<object> m_objs;
+	dynamic_distribution m_lights; //distribution to sample objects proportional to areaxflux
+	bvh m_bvh; //acceleration structure over m_objs
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,185 @@
+
+#pragma once
+
+#ifndef SHARED_FRAMEBUFFER_HPP
+#define SHARED_FRAMEBUFFER_HPP
+
+#include<atomic>
+#include<string>
+#include<cassert>
+#include<cstdint>
+#include<iostream>
+
+#if !defined(_WIN32)
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//shared_framebuffer
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//accumulation buffer (sum of RGB results of all iterations, double precision) placed in a POSIX shared-memory segment,
+//so that a local viewer process can map it read-only and display the running mean without copies or file I/O in the renderer
+//layout: header (64 bytes) followed by width x height x 3 doubles in scanline order
+//the header contains a sequence number (seqlock), which is odd while the renderer updates the buffer
+class shared_framebuffer
+{
+public:
+
+	struct header_t{
+		uint32_t magic;                //shared_framebuffer::magic
+		uint32_t version;              //shared_framebuffer::version
+		uint32_t width;
+		uint32_t height;
+		std::atomic<uint64_t> sequence; //odd while the buffer is being updated
+		uint64_t iterations;           //number of accumulated iterations (mean = buffer / iterations)
+		uint8_t padding[32];
+	};
+	static_assert(sizeof(header_t) == 64, "header of shared_framebuffer has to be 64 bytes");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "sequence number has to be lock-free to be shared between processes");
+
+	static const uint32_t magic = 0x42465352; //"RSFB"
+	static const uint32_t version = 1;
+
+	//create segment name (e.g., "/simple_ris_bpt") for w x h image (renderer side)
+	//the segment is removed when this object is destroyed (processes which mapped it can still read it)
+	shared_framebuffer(const std::string &name, const int w, const int h) : mp_header(), m_bytes(), m_name(name), m_owner(true)
+	{
+#if !defined(_WIN32)
+		const size_t bytes = sizeof(header_t) + sizeof(double) * 3 * size_t(w) * h;
+		const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if((fd >= 0) && (ftruncate(fd, off_t(bytes)) == 0)){
+			void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED){
+				mp_header = static_cast<header_t*>(p); m_bytes = bytes;
+			}
+		}
+		if(fd >= 0){
+			close(fd);
+		}
+		if(mp_header == nullptr){
+			std::cerr << "shared_framebuffer: failed to create " << name << std::endl;
+			if(fd >= 0){
+				shm_unlink(name.c_str());
+			}
+			return;
+		}
+
+		//contents of new segment are zero
+		mp_header->width = uint32_t(w);
+		mp_header->height = uint32_t(h);
+		mp_header->iterations = 0;
+		mp_header->version = version;
+		std::atomic_thread_fence(std::memory_order_release);
+		mp_header->magic = magic;
+#else
+		(void)w, (void)h;
+#endif
+	}
+
+	//map existing segment name read-only (viewer side). is_valid() returns false if it does not exist
+	explicit shared_framebuffer(const std::string &name) : mp_header(), m_bytes(), m_name(name), m_owner(false)
+	{
+#if !defined(_WIN32)
+		const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if(fd < 0){
+			return;
+		}
+		header_t header;
+		if(pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header)) && (header.magic == magic) && (header.version == version)){
+			const size_t bytes = sizeof(header_t) + sizeof(double) * 3 * size_t(header.width) * header.height;
+			void *p = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED){
+				mp_header = static_cast<header_t*>(p); m_bytes = bytes;
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	shared_framebuffer(const shared_framebuffer&) = delete;
+	shared_framebuffer &operator=(const shared_framebuffer&) = delete;
+	~shared_framebuffer()
+	{
+#if !defined(_WIN32)
+		if(mp_header != nullptr){
+			munmap(mp_header, m_bytes);
+			if(m_owner){
+				shm_unlink(m_name.c_str());
+			}
+		}
+#endif
+	}
+
+	bool is_valid() const
+	{
+		return (mp_header != nullptr);
+	}
+
+	int width() const
+	{
+		return assert(is_valid()), int(mp_header->width);
+	}
+	int height() const
+	{
+		return assert(is_valid()), int(mp_header->height);
+	}
+
+	//return accumulation buffer (width x height x 3 doubles)
+	double *data()
+	{
+		return assert(is_valid()), reinterpret_cast<double*>(mp_header + 1); //read-only for viewer
+	}
+	const double *data() const
+	{
+		return assert(is_valid()), reinterpret_cast<const double*>(mp_header + 1);
+	}
+
+	//renderer side: enclose updates of the buffer (iterations: number of accumulated iterations after the update)
+	void begin_write()
+	{
+		assert(is_valid() && m_owner);
+		mp_header->sequence.store(mp_header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void end_write(const uint64_t iterations)
+	{
+		assert(is_valid() && m_owner);
+		mp_header->iterations = iterations;
+		mp_header->sequence.store(mp_header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//viewer side: read the buffer between read_begin() and read_retry(), and read it again if read_retry() returns true
+	//(e.g., do { seq = fb.read_begin(); ...read fb.data() and fb.iterations()...; } while(fb.read_retry(seq));)
+	uint64_t read_begin() const
+	{
+		uint64_t seq;
+		while((seq = mp_header->sequence.load(std::memory_order_acquire)) & 1){
+		}
+		return seq;
+	}
+	bool read_retry(const uint64_t seq) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return (mp_header->sequence.load(std::memory_order_relaxed) != seq);
+	}
+
+	//return number of accumulated iterations (read between read_begin() and read_retry())
+	uint64_t iterations() const
+	{
+		return mp_header->iterations;
+	}
+
+private:
+
+	header_t *mp_header;
+	size_t m_bytes;
+	std::string m_name;
+	bool m_owner; //true if this process created the segment
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -6,6 +6,7 @@
 
 #include"ray.hpp"
 #include"rng.hpp"
+#include"aabb.hpp"
 #include"intersection.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -75,6 +76,25 @@ public:
 		}
 	}
 
+	//intersection test of n rays from the same origin o (d: unit directions, t_max: distances)
+	//occluded[i] is set to true if ray i intersects sphere in (t_min, t_max[i])
+	//terms depending only on the origin are computed once, and the loop has no branches to be auto-vectorized
+	void intersect(const vec3 &o, const float *dx, const float *dy, const float *dz, const float *t_max, const float t_min, const size_t n, bool *occluded) const
+	{
+		const vec3 co = o - m_c;
+		const float C = dot(co, co) - m_r * m_r;
+		for(size_t i = 0; i < n; i++){
+
+			const float B = dx[i] * co.x + dy[i] * co.y + dz[i] * co.z;
+			const float D = B * B - C;
+			const float sqrt_D = std::sqrt(std::max(D, 0.0f));
+			const float t1 = -B - sqrt_D;
+			const float t2 = -B + sqrt_D;
+			const float t = (t1 > t_min) ? t1 : t2;
+			occluded[i] |= (D > 0) && (t > t_min) && (t < t_max[i]);
+		}
+	}
+
 	//uniform sampling of sphere
 	sample_point sample(random_number_generator &rng) const
 	{
@@ -90,6 +110,21 @@ public:
 		return sample_point(n * m_r + m_c, n, nullptr, 1 / area());
 	}
 
+	const vec3 &center() const
+	{
+		return m_c;
+	}
+	float radius() const
+	{
+		return m_r;
+	}
+
+	//return axis-aligned bounding box
+	aabb bounds() const
+	{
+		return aabb(m_c - vec3(m_r), m_c + vec3(m_r));
+	}
+
 	//calculate surface area of sphere
 	float area() const
 	{
@@ -4,6 +4,9 @@
 #ifndef OUR_HPP
 #define OUR_HPP
 
+#include<array>
+#include<chrono>
+
 #include"our/path.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -22,36 +25,414 @@ public:
 	//constructor ( M : number of pre-sampled light sub-paths, nt : number of threads )
 	renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt = std::thread::hardware_concurrency());
 
+	//stages of an iteration (for counting heap allocations, time and rays)
+	enum stage_t{
+		stage_caches,      //generation of cache points
+		stage_light_paths, //generation of light sub-paths
+		stage_candidates,  //generation of candidates
+		stage_pmfs,        //construction of resampling pmfs
+		stage_radiance,    //radiance calculation
+		num_stages,
+	};
+
+	//groups of strategies (for per-strategy buffers, time and shadow rays)
+	enum strategy_group_t{
+		group_0t, //strategies (s=0,t>=2), i.e., unidirectional path tracing
+		group_s1, //strategies (s>=1,t=1), i.e., light tracing
+		group_st, //connection strategies (s>=1,t>=2), i.e., resampling strategies (or connections of standard BPT)
+		group_vm, //vertex merging
+		num_strategy_groups,
+	};
+
+	//splitting of per-strategy buffers
+	enum strategy_split_t{
+		split_none,  //per-strategy buffers are disabled
+		split_group, //a buffer for each group of strategies
+		split_st,    //a buffer for each (s,t) (s,t >= num_strategy_lengths-1 share the last buffer) and a buffer for vertex merging
+	};
+
+	//number of s (and t) distinguished by per-strategy buffers split by (s,t)
+	static const size_t num_strategy_lengths = 6;
+
+	//time (summed over threads) and number of shadow rays (including those for MIS weights) of a group of strategies
+	struct strategy_cost{
+		double time;
+		uint64_t shadow_rays;
+	};
+
 	//rendering
 	imagef render(const scene &scene, const camera &camera);
 
+	//rendering into screen (memory of screen is reused if its resolution does not change)
+	void render(const scene &scene, const camera &camera, imagef &screen);
+
+	//enable adaptive M. M is chosen in [M_min, M_max] between iterations from measured resampling efficiency
+	void set_adaptive_M(const size_t M_min, const size_t M_max);
+
+	//enable adjoint-driven russian roulette for eye sub-paths (Q at cache points approximates contributions of eye sub-paths)
+	void set_adjoint_rr(const bool enable)
+	{
+		m_adjoint_rr = enable;
+	}
+
+	//enable path guiding of eye sub-paths using directional distributions of candidates at cache points
+	void set_guiding(const bool enable)
+	{
+		m_guiding = enable;
+	}
+
+	//enable clustering of cache points (max_cluster_size > 1). only representatives of clusters construct resampling pmfs
+	//and the other cache points in each cluster (nearby cache points with similar normals) share the pmf of the representative
+	void set_cache_clustering(const size_t max_cluster_size)
+	{
+		m_max_cluster_size = std::max(max_cluster_size, size_t(1));
+	}
+
+	//enable sorting of candidates by Morton code of position and normal of their vertices in each iteration
+	//(nearby candidates are adjacent in the candidate vertex table and cdfs, so that shadow rays of pmf construction are coherent)
+	void set_candidate_sorting(const bool enable)
+	{
+		m_sort_candidates = enable;
+	}
+
+	//enable quantized cdfs of resampling pmfs (16-bit entries with a float base per block of 64 entries, about half the memory of float cdfs)
+	//resampling and the pmfs in MIS weights both use the quantized cdfs
+	void set_quantized_pmfs(const bool enable)
+	{
+		m_quantized_pmfs = enable;
+	}
+
+	//enable vertex merging (VCM-style photon density estimation at eye sub-path vertices) with initial radius r (disabled if r is 0)
+	//the radius is reduced in each iteration as r_i = r * i^((alpha-1)/2) (alpha = vm_alpha)
+	void set_vertex_merging(const float r)
+	{
+		m_vm_radius0 = r;
+	}
+
+	//set sampling strategies (e.g., disable light tracing, cap the number of vertices of sub-paths, or disable virtual cache point)
+	//disabled strategies are not sampled and dropped from MIS weights. if light tracing and vertex merging are disabled, only M light sub-paths are generated
+	//baselines (path tracing, light tracing, standard BPT) are sets of strategies without resampling, and skip candidates and resampling pmfs
+	void set_strategies(const strategy_set &strategies)
+	{
+		assert((strategies.max_s >= 1) && (strategies.max_t >= 1));
+		m_strategies = strategies;
+	}
+
+	//enable progressive preview (disabled if num_levels is 0)
+	//the first num_levels iterations are rendered at 1/2^k (k=num_levels,...,1) of the resolution in each dimension with M/2^k,
+	//and their results are enlarged to the resolution of camera. is_preview() returns true for these iterations
+	void set_preview(const size_t num_levels)
+	{
+		m_num_preview_levels = num_levels;
+	}
+
+	//return true if the last iteration was rendered as preview (the result should not be accumulated)
+	bool is_preview() const
+	{
+		return m_is_preview;
+	}
+
+	//place candidate vertex table and resampling pmfs in memory-mapped scratch files in directory dir (in memory if empty)
+	void set_scratch_directory(const std::string &dir)
+	{
+		m_scratch_dir = dir;
+	}
+
+	//limit memory of per-iteration structures (light sub-paths, candidates, cache points and resampling pmfs, framebuffers) to bytes (disabled if 0)
+	//the footprint is projected from the resolution, M, cache density and measured mean length of light sub-paths before each iteration,
+	//and clustering of cache points (sparse pmfs), scratch files for light sub-path vertices and pmfs (streaming), smaller M and lower cache density are chosen until it fits
+	void set_memory_budget(const size_t bytes)
+	{
+		m_memory_budget = bytes;
+	}
+
+	//enable per-strategy buffers, which store contributions of strategies in each iteration (the sum of the buffers is the result of the iteration)
+	//time and shadow rays of each group of strategies are also measured
+	void set_strategy_buffers(const strategy_split_t split)
+	{
+		m_strategy_split = split;
+	}
+
+	//return number of per-strategy buffers (0 if disabled)
+	size_t num_strategy_buffers() const;
+
+	//return name of per-strategy buffer idx (e.g., "st" or "s2_t3". "s5+_t2" stores strategies (s>=5,t=2))
+	std::string strategy_buffer_name(const size_t idx) const;
+
+	//return per-strategy buffer idx of the last iteration (contributions of light tracing are already divided by number of samples)
+	const imagef &strategy_buffer(const size_t idx) const
+	{
+		return m_strategy_buffers[idx];
+	}
+
+	//return sum of per-strategy buffer idx over full-resolution iterations (previews are not accumulated)
+	const imagef &strategy_sum(const size_t idx) const
+	{
+		return m_strategy_sums[idx];
+	}
+
+	//return time and shadow rays of each group of strategies in the last iteration (measured only if per-strategy buffers are enabled)
+	//shadow rays are counted for the first sharded_counter::num_shards threads tracing rays
+	const std::array<strategy_cost, num_strategy_groups> &strategy_costs() const
+	{
+		return m_strategy_costs;
+	}
+
+	//return time and shadow rays of each group of strategies summed over full-resolution iterations
+	const std::array<strategy_cost, num_strategy_groups> &total_strategy_costs() const
+	{
+		return m_total_strategy_costs;
+	}
+
+	//return first-hit albedo/normal of eye sub-paths in the last iteration (feature buffers for denoising)
+	const imagef &albedo() const
+	{
+		return m_albedo;
+	}
+	const imagef &normal() const
+	{
+		return m_normal;
+	}
+
+	//return number of pre-sampled light sub-paths used in the next iteration
+	size_t M() const
+	{
+		return m_M;
+	}
+
+	//return number of heap allocations in each stage of the last iteration
+	//(counted only if count_allocations.hpp is included in the program)
+	const std::array<size_t, num_stages> &allocations() const
+	{
+		return m_allocations;
+	}
+
+	//return time in seconds and number of rays of each stage of the last iteration
+	//(rays traced by other threads using the same scene during the iteration are also counted)
+	const std::array<double, num_stages> &times() const
+	{
+		return m_times;
+	}
+	const std::array<ray_count, num_stages> &rays() const
+	{
+		return m_rays;
+	}
+
+	//return number of rays of each stage summed over all iterations (including previews)
+	const std::array<ray_count, num_stages> &total_rays() const
+	{
+		return m_total_rays;
+	}
+
+	//write metrics of the renderer in Prometheus text format (stages, rays, kNN lookups, strategies, cache points, candidates and M)
+	//time: time of the last iteration in seconds
+	void write_metrics(prometheus_writer &writer, const double time) const;
+
+	//return number of cache points, representatives of clusters (cache points constructing pmfs) and candidates in the last iteration
+	size_t num_caches() const
+	{
+		return m_caches.end() - m_caches.begin();
+	}
+	size_t num_representatives() const
+	{
+		return m_representatives.size();
+	}
+	size_t num_candidates() const
+	{
+		return m_candidates.size();
+	}
+
+	//return name of stage
+	static const char *stage_name(const stage_t stage)
+	{
+		static const char *names[num_stages] = { "caches", "light paths", "candidates", "pmfs", "radiance" };
+		return names[stage];
+	}
+	static const char *strategy_group_name(const strategy_group_t group)
+	{
+		static const char *names[num_strategy_groups] = { "0t", "s1", "st", "vm" };
+		return names[group];
+	}
+
 private:
 
+	//scope of a stage of an iteration, which adds heap allocations, time and rays in the scope to the statistics of the stage
+	class stage_scope
+	{
+	public:
+
+		stage_scope(renderer &r, const stage_t stage) : m_allocations(r.m_allocations[stage]), m_rays(r.m_rays[stage]), m_time(r.m_times[stage]), m_start(std::chrono::steady_clock::now())
+		{
+		}
+		~stage_scope()
+		{
+			m_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+		}
+
+	private:
+
+		allocation_scope m_allocations;
+		ray_scope m_rays;
+		double &m_time;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	//scope of calculation of a group of strategies for a pixel, which adds time and shadow rays of the calling thread in the scope
+	//to the statistics of the group (nothing is measured if per-strategy buffers are disabled)
+	class strategy_scope
+	{
+	public:
+
+		strategy_scope(renderer &r, const strategy_group_t group) : mp_renderer((r.m_strategy_split != split_none) ? &r : nullptr), m_group(group)
+		{
+			if(mp_renderer != nullptr){
+				m_shadow_rays = num_shadow_rays.thread_value();
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+		~strategy_scope()
+		{
+			if(mp_renderer != nullptr){
+				mp_renderer->m_strategy_time[m_group].add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+				mp_renderer->m_strategy_shadow_rays[m_group].add(num_shadow_rays.thread_value() - m_shadow_rays);
+			}
+		}
+
+	private:
+
+		renderer *mp_renderer;
+		strategy_group_t m_group;
+		uint64_t m_shadow_rays;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	//return index of per-strategy buffer which stores contributions of strategy (s,t) of group
+	size_t strategy_buffer_index(const strategy_group_t group, const size_t s, const size_t t) const
+	{
+		if(m_strategy_split == split_group){
+			return group;
+		}
+		if(group == group_vm){
+			return num_strategy_lengths * num_strategy_lengths;
+		}
+		return std::min(s, num_strategy_lengths - 1) * num_strategy_lengths + std::min(t, num_strategy_lengths - 1);
+	}
+
+	//return true if per-strategy buffer idx stores contributions of strategies (s>=1,t=1), which are splatted by other pixels
+	bool is_splatted_strategy_buffer(const size_t idx) const
+	{
+		return (m_strategy_split == split_group) ? (idx == group_s1) : ((idx < num_strategy_lengths * num_strategy_lengths) && (idx % num_strategy_lengths == 1));
+	}
+
+	//render an iteration at resolution of camera
+	void render_iteration(const scene &scene, const camera &camera, imagef &screen);
+
+	//resize buffers for w x h image
+	void resize(const int w, const int h);
+
 	//calculate radiance for pixel (x,y)
 	col3 radiance(const int x, const int y, const scene &scene, const camera &camera, random_number_generator &rng);
 
 	//calculate contributions of strategies (s=0,t>=2) (i.e., unidirectional path tracing from eye) for Line 10 of Algorithm1
 	col3 calculate_0t(const scene &scene, const light_path &y, const camera_path &z);
 
+	//p_strategy_L: contributions of strategies of the pixel indexed by strategy_buffer_index (nullptr if per-strategy buffers are disabled)
+
 	//calculate resampling estimators (i.e., strategy (s>=1, t>=2)) in Eq. (6) (Lines 11 to 23 of Algorithm1)
-	col3 calculate_st(const scene &scene, const camera_path &z, random_number_generator &rng);
+	col3 calculate_st(const scene &scene, const camera_path &z, random_number_generator &rng, col3 *p_strategy_L);
+
+	//calculate contributions of strategies (s>=1,t>=2) of standard BPT (connections of all vertices of light sub-path y and eye sub-path z)
+	col3 calculate_connections(const scene &scene, const light_path &y, const camera_path &z, col3 *p_strategy_L);
 
 	//calculate contributions of strategies (s>=1,t=1) (i.e., light tracing) for Line 10 of Algorithm1
 	void calculate_s1(const scene &scene, const camera &camera, const light_path &y, const camera_path &z, random_number_generator &rng);
 
+	//calculate contributions of vertex merging (light sub-path vertices within radius of z(t-1) (t>=2))
+	col3 calculate_vm(const scene &scene, const camera_path &z, col3 *p_strategy_L);
+
+	//sort m_candidates by Morton code of position and normal of their vertices
+	void sort_candidates();
+
+	//group cache points into clusters (m_representatives/m_members)
+	void cluster_caches();
+
+	//choose M, cache density, clustering and streaming for w x h image so that the projected footprint fits into memory budget
+	void apply_memory_budget(const int w, const int h);
+
+	//return path of scratch file name
+	std::string scratch_file(const char *name) const;
+
+	//return number of light sub-paths generated in an iteration for w x h image with M pre-sampled light sub-paths
+	size_t num_light_paths(const int w, const int h, const size_t M) const;
+
+	//return projected number of resident bytes of per-iteration structures for w x h image
+	size_t projected_footprint(const int w, const int h, const size_t M, const float density, const bool clustering, const bool streaming) const;
+
+	//choose M for next iteration (time_pmf/time: time for constructing pmfs/whole iteration in seconds)
+	void update_M(const int w, const int h, const double time_pmf, const double time);
+
 private:
 
 	size_t m_M;
+	size_t m_M_min; //range of M for adaptive M (m_M_min == m_M_max if adaptive M is disabled)
+	size_t m_M_max;
+	float m_M_step; //multiplicative step of M for adaptive M (<1 if M is decreasing)
+	double m_efficiency; //efficiency 1/(variance*time) measured at previous iteration
 	size_t m_nt;
+	thread_pool m_pool; //worker threads kept between iterations
+	bool m_adjoint_rr; //flag for adjoint-driven russian roulette
+	bool m_guiding; //flag for path guiding
+	bool m_sort_candidates; //flag for sorting candidates by Morton code
+	bool m_quantized_pmfs; //flag for quantized cdfs of resampling pmfs
+	strategy_set m_strategies; //enabled sampling strategies
+	size_t m_max_cluster_size; //maximum number of cache points in a cluster (1 if clustering is disabled)
+	float m_vm_radius0; //initial radius of vertex merging (0 if vertex merging is disabled)
+	float m_vm_radius;  //radius of vertex merging in current iteration
+	float m_vm_eta;     //N*pi*r^2 (N: number of light sub-paths) in current iteration (0 if vertex merging is disabled)
+	size_t m_memory_budget; //memory budget for per-iteration structures in bytes (0 if disabled)
+	size_t m_M_budget;      //maximum M within memory budget
+	float m_cache_density;  //number of eye sub-paths traced per pixel to generate cache points
+	bool m_budget_clustering; //flag whether clustering of cache points is enabled to meet memory budget
+	bool m_streaming;         //flag whether vertex pool, candidate vertex table and resampling pmfs are placed in scratch files to meet memory budget
+	float m_mean_light_vertices;  //measured mean number of vertices of light sub-paths (0 if not measured yet)
+	float m_caches_per_path;      //measured mean number of cache points generated by an eye sub-path (0 if not measured yet)
+	float m_representative_ratio; //measured ratio of representatives to cache points with clustering (0 if not measured yet)
+	size_t m_num_preview_levels; //number of preview iterations
+	bool m_is_preview; //flag whether current/last iteration is preview
+	imagef m_preview; //result of preview iteration at reduced resolution
 	size_t m_ns1; //number of samples for strategy (s>=1,t=1), i.e., widthxheight of the image
 	float m_Qp;   //normalization factor for virtual cache point (uniform distribution) in Sec. 5.2
 	double m_sum; //sum of Qp for each iteration
 	double m_ite; //number of iterations
 	imagef m_buf_s1; //buffer to store contributions of strategy (s>=1,t=1) (i.e., light tracing)
+	imagef m_albedo; //buffer to store albedo at 1st vertex of eye sub-paths
+	imagef m_normal; //buffer to store normal at 1st vertex of eye sub-paths
 	kd_tree<cache> m_caches; //cache points. we store cache points in the previous iteration to calculate the normalization factor Q
+	std::vector<cache> m_new_caches; //cache points generated in current iteration (memory is reused between iterations)
+	std::vector<cache*> m_representatives; //cache points which construct resampling pmfs
+	std::vector<cache*> m_members; //cache points which share resampling pmfs of representatives
 	std::unique_ptr<spinlock[]> m_locks; //spinlock for exclusive access to m_buf_s1
-	std::vector<candidate> m_candidates; //pre-sampled light sub-paths ¥hat{Y} for resampling
-	std::vector<light_path> m_light_paths; //light sub-paths for strategies handled by BPT
+	std::vector<float, huge_page_allocator<float>> m_lum_st; //luminance of contributions of resampling strategies (s>=1,t>=2) for each pixel (for adaptive M)
+	std::vector<candidate, huge_page_allocator<candidate>> m_candidates; //pre-sampled light sub-paths ¥hat{Y} for resampling
+	std::vector<std::pair<uint64_t, candidate>> m_sorted_candidates; //Morton codes and candidates sorted by them (memory is reused between iterations)
+	mapped_array<light_path_vertex> m_candidate_vertices; //copies of vertices of m_candidates (in the same order)
+	mapped_array<float> m_pmfs; //cdfs of resampling pmfs at cache points (distribution_view::storage_size(V) floats for each cache point)
+	std::string m_scratch_dir; //directory for scratch files of m_candidate_vertices/m_pmfs (in memory if empty)
+	std::vector<light_path, huge_page_allocator<light_path>> m_light_paths; //light sub-paths for strategies handled by BPT
+	light_path_vertex_pool m_light_path_vertices; //vertices of m_light_paths
+	std::vector<candidate> m_vm_elems; //vertices of m_light_paths merged with eye sub-path vertices (except y(0) on light sources)
+	kd_tree<candidate> m_vm_vertices; //kd-tree of m_vm_elems
+	std::array<size_t, num_stages> m_allocations; //number of heap allocations in each stage of the last iteration
+	std::array<double, num_stages> m_times;       //time of each stage of the last iteration
+	std::array<ray_count, num_stages> m_rays;     //number of rays of each stage of the last iteration
+	std::array<ray_count, num_stages> m_total_rays; //number of rays of each stage of all iterations
+	strategy_split_t m_strategy_split; //splitting of per-strategy buffers
+	std::vector<imagef> m_strategy_buffers; //contributions of strategies in current/last iteration
+	std::array<sharded_counter, num_strategy_groups> m_strategy_time;        //accumulated time of each group of strategies in nanoseconds
+	std::array<sharded_counter, num_strategy_groups> m_strategy_shadow_rays; //accumulated number of shadow rays of each group of strategies
+	std::array<strategy_cost, num_strategy_groups> m_strategy_costs; //time and shadow rays of each group of strategies in the last iteration
+	std::vector<imagef> m_strategy_sums; //sums of per-strategy buffers over full-resolution iterations
+	std::array<strategy_cost, num_strategy_groups> m_total_strategy_costs; //time and shadow rays of each group of strategies over full-resolution iterations
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -18,12 +18,45 @@ namespace our{
 //generation of (rr_threshold+1)-th vertex of sub-path may be terminated.
 const size_t rr_threshold = 5;
 
+//number of vertices reserved for sub-paths constructed by each thread (longer sub-paths allocate memory)
+const size_t initial_path_capacity = 64;
+
+//lower bound of the ratio Q/(average Q) used for adjoint-driven russian roulette
+//(avoids zero survival probability in regions where Q is underestimated)
+const float rr_min_adjoint = 0.05f;
+
+//probability to sample directions of eye sub-paths from guiding distributions of cache points (path guiding)
+const float guiding_fraction = 0.5f;
+
 //clamping parameter for geometry term G in cache point
 const float G_max = 1e6f;
 
 //clamping parameter epsilon in Sec. 5.1
 const float mis_threshold = 1e-3f;
 
+//minimum cosine between normals of cache points in the same cluster (cache points sharing a resampling pmf)
+const float cluster_cos_threshold = 0.9f;
+
+//parameter alpha of radius reduction of vertex merging (as in progressive photon mapping)
+const float vm_alpha = 0.75f;
+
+//number of candidates sampled from the pmf of the representative to estimate Z of other cache points in the cluster
+const size_t num_cluster_Z_samples = 16;
+
+//number of eye sub-paths traced per pixel to generate cache points
+const float cache_density = 0.004f;
+
+//limits of memory budget: M and cache density are not reduced below these values,
+//and clusters of this size are used if clustering of cache points is enabled to meet the budget
+const size_t budget_min_M = 16;
+const float budget_min_cache_density = 0.0005f;
+const size_t budget_cluster_size = 8;
+
+//statistics assumed until they are measured in the 1st iteration (for memory budget and the size of vertex pool)
+const float typical_light_path_vertices = 6.0f; //mean number of vertices of light sub-paths
+const float typical_caches_per_path = 5.0f;     //mean number of cache points generated by an eye sub-path
+const float typical_representative_ratio = 0.25f; //ratio of representatives to cache points with clustering
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //forward declaration
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -31,6 +64,115 @@ const float mis_threshold = 1e-3f;
 class light_path;
 class camera_path;
 
+//directional distribution for path guiding (8x16 bins)
+using guide = directional_distribution<8, 16>;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//strategy_set
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//set of sampling strategies used for rendering
+//sub-paths are not extended beyond max_s/max_t vertices, so that paths with more than max_s+max_t vertices are not sampled (as a maximum path length),
+//and MIS weights include only the terms of enabled strategies, so that the weights of each sampled path sum to one
+//baselines are expressed as sets of strategies, e.g., standard BPT connects to the light sub-path of the pixel instead of resampled candidates
+struct strategy_set
+{
+	//sampling of light sub-path vertices connected to eye sub-path vertices in strategies (s>=1,t>=2)
+	enum connection_t{
+		connect_resampled,  //vertices resampled from candidates at cache points (RIS-BPT)
+		connect_light_path, //vertices of the light sub-path of the pixel (standard BPT)
+	};
+
+	strategy_set() : s1(true), virtual_cache(true), max_s(SIZE_MAX), max_t(SIZE_MAX), connection(connect_resampled), resampling_gain(true), cached_visibility(true)
+	{
+	}
+
+	//return true if connection strategy (s,t) (s>=1,t>=2) is enabled
+	bool resampling(const size_t s, const size_t t) const
+	{
+		return (s <= max_s) && (t <= max_t);
+	}
+
+	//return true if vertex merging of light sub-path with s vertices and eye sub-path with t vertices (both including the merged vertex) is enabled
+	bool merging(const size_t s, const size_t t) const
+	{
+		return (s <= max_s) && (t <= max_t);
+	}
+
+	//return true if strategy (s=0,t) (unidirectional path tracing) is enabled
+	bool unidirectional(const size_t t) const
+	{
+		return (t <= max_t);
+	}
+
+	//return true if strategy (s,t=1) (light tracing) is enabled
+	bool light_tracing(const size_t s) const
+	{
+		return s1 && (s <= max_s);
+	}
+
+	//return true if resampling pmfs at cache points are used (i.e., candidates and pmfs have to be constructed)
+	bool uses_resampling() const
+	{
+		return (connection == connect_resampled) && (max_s >= 1) && (max_t >= 2);
+	}
+
+	//return ratio of pdf of resampling through a cache point to pdf of the light sub-path in Sec. 5.1
+	//(M: number of pre-sampled light sub-paths, Q_over_q: Q/(q*/p) at the cache point, clamped by the caller)
+	//without resampling gain, the ratio is 1 as for a light sub-path sampled once (plain balance heuristic)
+	float resampling_ratio(const float M, const float Q_over_q) const
+	{
+		return resampling_gain ? M / ((M - 1) * Q_over_q + 1) : 1;
+	}
+
+	bool s1;            //strategies (s>=1,t=1) (light tracing)
+	bool virtual_cache; //selection of virtual cache point (uniform resampling of all candidates) in resampling strategies
+	size_t max_s;       //maximum number of vertices of light sub-paths
+	size_t max_t;       //maximum number of vertices of eye sub-paths (including z(0) on the lens)
+	connection_t connection; //sampling of connected light sub-path vertices
+	bool resampling_gain;    //weighting resampling strategies with resampling-aware pdfs (plain balance heuristic if false)
+	bool cached_visibility;  //reusing G*V of neighbor cache points of z(t-2) to z(t-1) in MIS weights (tested once per eye sub-path instead of once per connection)
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//light_path_vertex_pool
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//storage for vertices of all light sub-paths of an iteration (memory is reused between iterations)
+class light_path_vertex_pool
+{
+public:
+
+	light_path_vertex_pool() : m_size(0)
+	{
+	}
+
+	//discard all vertices and prepare storage for at least n vertices (in memory-mapped scratch file if filename is not empty)
+	void reset(const size_t n, const std::string &filename = std::string())
+	{
+		m_vertices.allocate(n, filename);
+		m_size = 0;
+	}
+
+	//return storage for n vertices (nullptr if the pool is full)
+	light_path_vertex *allocate(const size_t n)
+	{
+		const size_t i = m_size.fetch_add(n, std::memory_order_relaxed);
+		return (i + n <= m_vertices.size()) ? m_vertices.data() + i : nullptr;
+	}
+
+	//return number of vertices requested since reset (including requests that failed)
+	size_t requested() const
+	{
+		return m_size.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	mapped_array<light_path_vertex> m_vertices;
+	std::atomic<size_t> m_size;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //light_path
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -39,10 +181,19 @@ class light_path
 {
 public:
 
-	void construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches);
+	light_path() : mp_vertices(), m_size()
+	{
+	}
+	light_path(light_path&&) = default;
+	light_path &operator=(light_path&&) = default;
+
+	//vertices are stored in pool (or in memory owned by this path if pool is full)
+	//max_vertices: maximum number of vertices (the path is terminated after the vertex)
+	//calc_FGVc: flag to calculate q*/p at neighbor cache points (only used by MIS weights of resampling strategies)
+	void construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches, light_path_vertex_pool &pool, const size_t max_vertices = SIZE_MAX, const bool calc_FGVc = true);
 
-	//zi : z(i), zip1: z(i+1), FGVc: array to store F(brdf)*GV at neighbor cache points of z(i)
-	static std::tuple<float, float, col3> pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc);
+	//zi : z(i), zip1: z(i+1), FGVc&GVc: arrays to store F(brdf)*GV and GV at neighbor cache points of z(i) (not calculated if calc_FGVc is false)
+	static std::tuple<float, float, col3> pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc, std::array<float, Nc> &GVc, const bool calc_FGVc = true);
 
 	//return sampling pdf of z(i) from z(i+1) (n: z(i) is n-th vertex from light source)
 	static float pdf(const camera_path_vertex &zi, const camera_path_vertex &zip1, const size_t n);
@@ -51,30 +202,35 @@ public:
 	static std::tuple<float, col3> pdf_FG(const camera_path_vertex &ztm1, const light_path_vertex &ysm1, const size_t n, const direction &zy, const direction &yz);
 
 	//ztm2: z(t-2), ztm1: z(t-1), n: z(t-2) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
-	static std::tuple<float, col3> pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc);
+	//(FGVc is not calculated if calc_FGVc is false, e.g., if resampling strategies at z(t-2) are disabled)
+	//cached_GV: flag to reuse GV stored in z(t-2) (tested and stored on the first call for the eye sub-path if not stored in construction)
+	static std::tuple<float, col3> pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc, const bool calc_FGVc = true, const bool cached_GV = false);
 
 	//return MIS partial weight (yz : direction from y(s-1) to z(t-1), zy: direction from z(t-1) to y(s-1), Qp : normalization factor for virtual cache point)
-	static float mis_partial_weight(const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp);
+	//eta: N*pi*r^2 of vertex merging (0 if vertex merging is disabled), strategies: enabled strategies
+	static float mis_partial_weight(const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float eta, const strategy_set &strategies);
 
 	//return number of vertices
 	size_t num_vertices() const
 	{
-		return m_vertices.size() - 1; //decrement to exclude dummy vertex
+		return m_size - 1; //decrement to exclude dummy vertex
 	}
 
 	//return path vertex
 	light_path_vertex &operator()(const size_t i)
 	{
-		return m_vertices[i + 1]; //increment to exclude dummy vertex
+		return assert(i + 1 < m_size), mp_vertices[i + 1]; //increment to exclude dummy vertex
 	}
 	const light_path_vertex &operator()(const size_t i) const
 	{
-		return m_vertices[i + 1];
+		return assert(i + 1 < m_size), mp_vertices[i + 1];
 	}
 
 private:
 
-	std::vector<light_path_vertex> m_vertices;
+	light_path_vertex *mp_vertices; //vertices (including dummy vertex) in pool or in m_overflow
+	size_t m_size;
+	std::vector<light_path_vertex> m_overflow; //vertices which do not fit into pool
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -85,11 +241,12 @@ class camera_path
 {
 public:
 
-	//x,y: pixel coordinate
-	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng);
+	//x,y: pixel coordinate, max_vertices: maximum number of vertices including z(0)
+	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const size_t max_vertices = SIZE_MAX);
 
-	//x,y: pixel coordinate, caches: cache points
-	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches);
+	//x,y: pixel coordinate, caches: cache points, max_vertices: maximum number of vertices including z(0)
+	//calc_FGVc: flag to calculate FGV at neighbor cache points (only used by MIS weights of resampling strategies)
+	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches, const size_t max_vertices = SIZE_MAX, const bool calc_FGVc = true);
 
 	//return sampling pdfs (with RR and without RR) of y(i) from y(i+1)
 	static std::tuple<float, float> pdfs(const light_path_vertex &yi, const light_path_vertex &yip1);
@@ -104,7 +261,8 @@ public:
 	static float pdf(const light_path_vertex &ysm2, const light_path_vertex &ysm1, const size_t n, const direction &yz);
 
 	//return MIS partial weight (yz/zy directions from y(s-1)/z(t-1) to z(t-1)/y(s-1), Qp: normalization factor for virtual cache point)
-	static float mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp);
+	//eta: N*pi*r^2 of vertex merging (0 if vertex merging is disabled), strategies: enabled strategies
+	static float mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float eta, const strategy_set &strategies);
 
 	size_t num_vertices() const
 	{
@@ -121,6 +279,11 @@ public:
 		return m_vertices[i];
 	}
 
+private:
+
+	//x,y: pixel coordinate, p_caches: cache points (nullptr if cache points are not available), max_vertices: maximum number of vertices
+	void construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> *p_caches, const size_t max_vertices);
+
 private:
 
 	size_t m_ns1; //number of samples for strategies (s>=1,t=1) (i.e., widthxheight)
@@ -166,31 +329,91 @@ private:
 //cache
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-class cache : public distribution<candidate>, protected camera_path_vertex
+class cache : public distribution_view<candidate>, protected camera_path_vertex
 {
 public:
 
 	//v: eye sub-path vertex, first_iteration: flag to detect whether first iteration or not
 	cache(const camera_path_vertex &v, const bool first_iteration);
 
-	//construct resampling pmf (candidates: pre-sampled light sub-paths)
-	void calc_distribution(const scene &scene, const std::vector<candidate> &candidates, const size_t M);
+	//construct resampling pmf (candidates: V pre-sampled light sub-path vertices, vertices: copies of their path vertices in the same order, cdf: storage for distribution_view::storage_size(V, quantized) floats)
+	//coherent: flag whether consecutive candidates are nearby (e.g., sorted by Morton code), so that their shadow rays are tested together
+	//quantized: flag to store the cdf as 16-bit entries in blocks (see distribution_view)
+	void calc_distribution(const scene &scene, const candidate *candidates, const light_path_vertex *vertices, const size_t V, const size_t M, float *cdf, const bool coherent = false, const bool quantized = false);
+
+	//share resampling pmf of the representative of the cluster (its pmf has to be constructed)
+	//Z of this cache point is estimated cheaply using candidates sampled from the shared pmf
+	void share_distribution(const scene &scene, const light_path_vertex *vertices, const size_t M);
+
+	//construct guiding distribution for next iteration from resampling pmf (directions to candidates weighted by q*/p)
+	void calc_guide();
 
 	//calculate F(brdf)*G(geo term)*V(visibility) at cache point
+	//(at the representative of the cluster, so that it is consistent with the resampling pmf)
 	col3 calc_FGV(const scene &scene, const ::intersection &x, const ::brdf &brdf) const;
 
+	//calculate G(clamped geo term)*V(visibility) at cache point, and F*G*V from it without visibility test
+	//(F*G*V of the same pair of points with different BRDFs, e.g., in MIS weights, needs only one shadow ray)
+	float calc_GV(const scene &scene, const ::intersection &x) const;
+	col3 calc_FGV(const ::intersection &x, const ::brdf &brdf, const float GV) const;
+
+	//set/return representative of the cluster including this cache point (this cache point itself if clustering is disabled)
+	void set_representative(const cache &c)
+	{
+		mp_representative = &c;
+	}
+	const cache &representative() const
+	{
+		return (mp_representative != nullptr) ? *mp_representative : *this;
+	}
+	bool is_clustered() const
+	{
+		return (mp_representative != nullptr);
+	}
+
 	//return estimate of Q (normalization factor of target distribution)
 	float Q() const
 	{
 		return m_Q;
 	}
 
+	//return guiding distribution of incident light (invalid if path guiding is disabled)
+	const our::guide &guide() const
+	{
+		return m_guide;
+	}
+
+	//set/return ratio of Q to average Q of all cache points used for adjoint-driven russian roulette (1 if disabled)
+	void set_rr_adjoint(const float rr_adjoint)
+	{
+		m_rr_adjoint = rr_adjoint;
+	}
+	float rr_adjoint() const
+	{
+		return m_rr_adjoint;
+	}
+
 	using camera_path_vertex::intersection;
 
+private:
+
+	//calculate clamped G (wo/wi: directions from x to c_isect and back, dist: distance between them), G*V and F*G*V at cache point c_isect
+	static float calc_G(const ::intersection &c_isect, const ::intersection &x, direction &wo, direction &wi, float &dist);
+	static col3 calc_FGV(const ::intersection &c_isect, const scene &scene, const ::intersection &x, const ::brdf &brdf);
+	static float calc_GV(const ::intersection &c_isect, const scene &scene, const ::intersection &x);
+	static col3 calc_FGV(const ::intersection &c_isect, const ::intersection &x, const ::brdf &brdf, const float GV);
+
+	//calculate luminance of Le_throughput*F*G*V (i.e., q*/p) of n vertices at cache point c_isect (shadow rays of batches of vertices are tested at once)
+	static void calc_weights(const ::intersection &c_isect, const scene &scene, const light_path_vertex *vertices, const size_t n, float *weights);
+
 private:
 
 	float m_Z; //normalization factor estimated using light sub-paths in current iteration
 	float m_Q; //normalization factor estimated using light sub-paths in previous iteration
+	float m_rr_adjoint; //Q relative to average Q (used as cheap approximation of the contribution of eye sub-paths)
+	our::guide m_guide; //guiding distribution estimated using light sub-paths in previous iteration
+	our::guide m_guide_next; //guiding distribution estimated using light sub-paths in current iteration
+	const cache *mp_representative; //representative of the cluster (nullptr if not clustered yet)
 };
 
 inline float rr_probability(const col3 &f, const float cos, const float pdf)
@@ -198,6 +421,160 @@ inline float rr_probability(const col3 &f, const float cos, const float pdf)
 	return std::min(luminance(f) * cos / pdf, 1.0f);
 }
 
+//russian roulette probability for eye sub-paths at vertex v (v: vertex sampling next direction, neighbor cache points of v have to be set)
+//incident light estimated at cache points scales the throughput-based probability, so that paths in dark regions are terminated early
+//since the probability depends only on v, it is also evaluated for light sub-path vertices when backward pdfs are calculated
+template<class Vertex> inline float rr_probability(const col3 &f, const float cos, const float pdf, const Vertex &v)
+{
+	float adjoint = 0;
+	for(size_t i = 0; i < Nc; i++){
+		adjoint += v.neighbor_cache(i).rr_adjoint();
+	}
+	return std::min(luminance(f) * cos / pdf * (adjoint / Nc), 1.0f);
+}
+
+//return probabilities P_c to select neighbor cache points of v (first Nc entries) and virtual cache point (last entry) in Sec. 5.2
+//the virtual cache point is selected with probability 1/(Nc+1), and the rest is divided between neighbor cache points
+//in proportion to normal similarity and distance (relative to the nearest one). neighbor cache points with zero normalization
+//constants or facing away from v are never selected (if no neighbor cache point can be selected, the virtual one is always selected)
+//if virtual_cache is false, the virtual cache point is never selected (all probabilities are zero if no neighbor cache point can be selected)
+template<class Vertex> inline std::array<float, Nc + 1> cache_selection_pmf(const Vertex &v, const bool virtual_cache = true)
+{
+	const vec3 &p = v.intersection().p();
+	const vec3 &n = v.intersection().n();
+
+	float d2[Nc], d2_min = FLT_MAX;
+	for(size_t i = 0; i < Nc; i++){
+		d2[i] = squared_norm(v.neighbor_cache(i).intersection().p() - p);
+		d2_min = std::min(d2_min, d2[i]);
+	}
+	d2_min = std::max(d2_min, 1e-12f);
+
+	std::array<float, Nc + 1> pmf;
+	float sum = 0;
+	for(size_t i = 0; i < Nc; i++){
+		const cache &c = v.neighbor_cache(i);
+		if(c.normalization_constant() > 0){
+			pmf[i] = std::max(dot(n, c.intersection().n()), 0.0f) / (1 + d2[i] / d2_min);
+		}else{
+			pmf[i] = 0;
+		}
+		sum += pmf[i];
+	}
+	if(virtual_cache == false){
+		const float scale = (sum > 0) ? 1 / sum : 0;
+		for(size_t i = 0; i < Nc; i++){
+			pmf[i] *= scale;
+		}
+		pmf[Nc] = 0;
+	}else if(sum > 0){
+		const float scale = Nc / (float(Nc + 1) * sum);
+		for(size_t i = 0; i < Nc; i++){
+			pmf[i] *= scale;
+		}
+		pmf[Nc] = 1 / float(Nc + 1);
+	}else{
+		pmf[Nc] = 1;
+	}
+	return pmf;
+}
+
+//return term of connection strategy at vertex v in MIS partial weights (ratio of its pdf to pdf of the light sub-path)
+//q(j): q*/p of the light sub-path vertex at j-th neighbor cache point of v (only called for cache points which can be selected)
+//Qp: normalization factor for virtual cache point. standard BPT samples each connection once, so that the term is 1
+template<class Vertex, class Func> inline float connection_term(const Vertex &v, Func q, const float M, const float Qp, const strategy_set &strategies)
+{
+	if(strategies.connection == strategy_set::connect_light_path){
+		return 1;
+	}
+	const auto Pc = cache_selection_pmf(v, strategies.virtual_cache);
+	float term = 0;
+	for(size_t j = 0; j < Nc; j++){
+		if(Pc[j] > 0){
+			const float Q = v.neighbor_cache(j).Q();
+			const float Le_throughput_FGVc = q(j);
+			if(Le_throughput_FGVc > 0){
+				term += Pc[j] * strategies.resampling_ratio(M, std::max(mis_threshold, Q / Le_throughput_FGVc));
+			}
+		}
+	}
+	term += Pc[Nc] * strategies.resampling_ratio(M, Qp);
+	return term;
+}
+
+//return solid angle pdf to sample direction w at eye sub-path vertex v (v: vertex with neighbor cache points, brdf: BRDF at v)
+//BRDF sampling and guiding distributions of the neighbor cache points are combined by one-sample MIS (i.e., mixture pdf)
+template<class Vertex> inline float pdf_guided(const brdf &brdf, const Vertex &v, const direction &w)
+{
+	const float pdf_brdf = brdf.pdf(w);
+
+	float pdf_guide = 0;
+	for(size_t i = 0; i < Nc; i++){
+		const auto &guide = v.neighbor_cache(i).guide();
+		pdf_guide += guide.is_valid() ? guide.pdf(w) : pdf_brdf;
+	}
+	return (1 - guiding_fraction) * pdf_brdf + guiding_fraction * (pdf_guide / Nc);
+}
+
+//sample direction at eye sub-path vertex v using BRDF sampling or guiding distribution of one of the neighbor cache points
+template<class Vertex> inline brdf_sample sample_guided(const brdf &brdf, const Vertex &v, const vec3 &n, random_number_generator &rng)
+{
+	bool is_guided = false;
+	for(size_t i = 0; i < Nc; i++){
+		is_guided |= v.neighbor_cache(i).guide().is_valid();
+	}
+	if(is_guided == false){
+		return brdf.sample(rng);
+	}
+
+	direction w;
+	if(rng.generate_uniform_real() < guiding_fraction){
+		const auto &guide = v.neighbor_cache(rng.generate_uniform_int(0, Nc - 1)).guide();
+		w = guide.is_valid() ? direction(guide.sample(rng), n) : brdf.sample(rng).w();
+	}else{
+		w = brdf.sample(rng).w();
+	}
+	if(w.is_invalid() || w.in_lower_hemisphere()){
+		return brdf_sample();
+	}
+	return brdf_sample(w, brdf.f(w), pdf_guided(brdf, v, w));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//neighbor_caches
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//nearest cache points of a point (used before the path vertex at the point is created)
+class neighbor_caches
+{
+public:
+
+	neighbor_caches() : m_cache_ptrs()
+	{
+	}
+
+	//p: query point, caches: cache points
+	neighbor_caches(const kd_tree<cache> &caches, const vec3 &p)
+	{
+		thread_local std::vector<neighbor<cache>> neighbors;
+		caches.find_nearest(p, FLT_MAX, Nc, neighbors);
+
+		for(size_t i = 0; i < Nc; i++){
+			m_cache_ptrs[i] = &*neighbors[i];
+		}
+	}
+
+	//return i-th nearest cache point
+	const cache &neighbor_cache(const size_t i) const
+	{
+		return assert(m_cache_ptrs[i] != nullptr), *m_cache_ptrs[i];
+	}
+
+private:
+
+	const cache *m_cache_ptrs[Nc];
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 } //namespace our
@@ -8,7 +8,7 @@ namespace our{
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //constructor (v: eye sub-path vertex, first_iteration: flag (true for 1st iteration, false otherwise)
-inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : camera_path_vertex(v)
+inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : camera_path_vertex(v), m_rr_adjoint(1), mp_representative()
 {
 	if(first_iteration){
 		m_Q = -1;//for first iteration, normalization factor Q will be estimated in calc_distribution
@@ -20,21 +20,45 @@ inline cache::cache(const camera_path_vertex &v, const bool first_iteration) : c
 			m_Q += v.neighbor_cache(i).m_Z; //m_Z is estimate of Q using ¥bar{Y}_{n-1} stored at neighbor cache points
 		}
 		m_Q /= Nc;
+
+		//guiding distribution is also approximated using those estimated in previous iteration
+		for(size_t i = 0; i < Nc; i++){
+			m_guide.add(v.neighbor_cache(i).m_guide_next, 1.0f / Nc);
+		}
+		m_guide.build();
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //construct resampling pmf
-inline void cache::calc_distribution(const scene &scene, const std::vector<candidate> &candidates, const size_t M)
+inline void cache::calc_distribution(const scene &scene, const candidate *candidates, const light_path_vertex *vertices, const size_t V, const size_t M, float *cdf, const bool coherent, const bool quantized)
 {
 	//construct resampling pmf (q*/p) (Line 5 in Algorithm1)
-	auto weight = [&](const candidate &c){ 
-		return luminance(c.vertex().Le_throughput() * calc_FGV(scene, c.vertex().intersection(), c.vertex().brdf())); 
-	};
-	distribution<candidate>::operator=(
-		distribution<candidate>(candidates, weight)
-	);
+	//vertices of candidates are read sequentially from the candidate vertex table
+	//(shadow rays to coherent candidates are tested in batches. rays to scattered candidates are tested one by one,
+	//since a batch of them visits most nodes of the acceleration structure)
+	if(coherent){
+		thread_local std::vector<float> weights;
+		reserve_with_headroom(weights, V);
+		weights.resize(V);
+		calc_weights(representative().intersection(), scene, vertices, V, weights.data());
+
+		auto weight = [&](const candidate &c){
+			return weights[&c - candidates];
+		};
+		distribution_view<candidate>::operator=(
+			distribution_view<candidate>(candidates, V, cdf, weight, quantized)
+		);
+	}else{
+		auto weight = [&](const candidate &c){
+			const light_path_vertex &v = vertices[&c - candidates];
+			return luminance(v.Le_throughput() * calc_FGV(scene, v.intersection(), v.brdf()));
+		};
+		distribution_view<candidate>::operator=(
+			distribution_view<candidate>(candidates, V, cdf, weight, quantized)
+		);
+	}
 
 	//estimate Q using M pre-sampled light sub-paths in current iteration
 	//m_Z is used in the next iteration (Line 6 in Algorithm1)
@@ -48,31 +72,162 @@ inline void cache::calc_distribution(const scene &scene, const std::vector<candi
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+//share resampling pmf of the representative
+inline void cache::share_distribution(const scene &scene, const light_path_vertex *vertices, const size_t M)
+{
+	distribution_view<candidate>::operator=(representative());
+
+	//Z of this cache point is estimated by importance sampling of the shared pmf (stratified samples)
+	//sum(q*/p) = E[q*/p / pmf], where q* uses F*G*V at this cache point instead of the representative
+	double sum = 0;
+	if(normalization_constant() > 0){
+		const auto &c_isect = camera_path_vertex::intersection();
+		for(size_t i = 0; i < num_cluster_Z_samples; i++){
+			const auto sample = distribution_view<candidate>::sample((i + 0.5f) / num_cluster_Z_samples);
+			const light_path_vertex &v = vertices[sample.p_elem - begin()];
+			sum += luminance(v.Le_throughput() * calc_FGV(c_isect, scene, v.intersection(), v.brdf())) / sample.pmf;
+		}
+	}
+	m_Z = float(sum / num_cluster_Z_samples) / M;
+
+	//for first iteration ¥hat{Y}_1 is used
+	if(m_Q == -1){
+		m_Q = m_Z;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//construct guiding distribution for next iteration
+inline void cache::calc_guide()
+{
+	//directions from cache point to candidates are weighted by q*/p (i.e., pmf * normalization constant)
+	const auto &c_isect = camera_path_vertex::intersection();
+	for(size_t i = 0, n = end() - begin(); i < n; i++){
+
+		const float weight = pmf(i);
+		if(weight > 0){
+			const vec3 w = (begin() + i)->vertex().intersection().p() - c_isect.p();
+			m_guide_next.add(w / norm(w), weight);
+		}
+	}
+	m_guide_next.build();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
 //calculate F(brdf)*G(geo. term)*V(visibility) at cache point
 inline col3 cache::calc_FGV(const scene &scene, const ::intersection &x, const ::brdf &brdf) const
 {
-	const auto &c_isect = camera_path_vertex::intersection();
+	return calc_FGV(representative().intersection(), scene, x, brdf);
+}
+
+//calculate F*G*V at cache point c_isect
+inline col3 cache::calc_FGV(const ::intersection &c_isect, const scene &scene, const ::intersection &x, const ::brdf &brdf)
+{
+	return calc_FGV(c_isect, x, brdf, calc_GV(c_isect, scene, x));
+}
 
+//calculate G*V at cache point
+inline float cache::calc_GV(const scene &scene, const ::intersection &x) const
+{
+	return calc_GV(representative().intersection(), scene, x);
+}
+
+//calculate F*G*V at cache point from G*V (no visibility test)
+inline col3 cache::calc_FGV(const ::intersection &x, const ::brdf &brdf, const float GV) const
+{
+	return calc_FGV(representative().intersection(), x, brdf, GV);
+}
+
+//calculate clamped G between cache point c_isect and x (0 if they are in lower hemispheres of each other)
+//wo: direction from x to c_isect, wi: direction from c_isect to x, dist: distance between them (for the shadow ray of V)
+inline float cache::calc_G(const ::intersection &c_isect, const ::intersection &x, direction &wo, direction &wi, float &dist)
+{
 	const vec3 tmp_wo = c_isect.p() - x.p();
 	const float dist2 = squared_norm(tmp_wo);
-	const float dist = sqrt(dist2);
-	const direction wo(tmp_wo / dist, x.n());
+	dist = sqrt(dist2);
+	wo = direction(tmp_wo / dist, x.n());
 	if(wo.is_invalid() || wo.in_lower_hemisphere()){
-		return col3();
+		return 0;
 	}
 
-	const direction wi(-wo, c_isect.n());
+	wi = direction(-wo, c_isect.n());
 	if(wi.is_invalid() || wi.in_lower_hemisphere()){
-		return col3();
+		return 0;
 	}
-	
+
+	//clamp G term to avoid unstable estimation of Q
+	//(for glossy BRDFs, it would be better to clamp F*G instead of G only)
+	return std::min(wi.abs_cos() * wo.abs_cos() / dist2, G_max);
+}
+
+//calculate G*V at cache point c_isect
+inline float cache::calc_GV(const ::intersection &c_isect, const scene &scene, const ::intersection &x)
+{
+	direction wo, wi;
+	float dist;
+	const float G = calc_G(c_isect, x, wo, wi, dist);
+
 	//visibility test for V
-	if(scene.intersect(ray(c_isect.p(), wi, dist)) == false){
-		//clamp G term to avoid unstable estimation of Q
-		//(for glossy BRDFs, it would be better to clamp F*G instead of G only)
-		return brdf.f(wo) * std::min(wi.abs_cos() * wo.abs_cos() / dist2, G_max);
+	if((G > 0) && (scene.intersect(ray(c_isect.p(), wi, dist)) == false)){
+		return G;
+	}
+	return 0;
+}
+
+//calculate F*G*V at cache point c_isect from G*V
+inline col3 cache::calc_FGV(const ::intersection &c_isect, const ::intersection &x, const ::brdf &brdf, const float GV)
+{
+	if(GV == 0){
+		return col3();
+	}
+	const vec3 tmp_wo = c_isect.p() - x.p();
+	return brdf.f(direction(tmp_wo / norm(tmp_wo), x.n())) * GV;
+}
+
+//calculate q*/p of n vertices at cache point c_isect
+//all shadow rays start at c_isect, so that rays of each batch are tested at once (rays are coherent if vertices are sorted spatially)
+inline void cache::calc_weights(const ::intersection &c_isect, const scene &scene, const light_path_vertex *vertices, const size_t n, float *weights)
+{
+	const size_t batch_size = 16;
+	const vec3 p0 = c_isect.p();
+
+	for(size_t begin = 0; begin < n; begin += batch_size){
+
+		const size_t nB = std::min(batch_size, n - begin);
+
+		//F*G of vertices in upper hemispheres (same as calc_FGV)
+		size_t idx[batch_size];
+		col3 FG[batch_size];
+		float ux[batch_size], uy[batch_size], uz[batch_size], t_max[batch_size];
+		size_t nC = 0;
+		for(size_t i = 0; i < nB; i++){
+
+			weights[begin + i] = 0;
+
+			const light_path_vertex &v = vertices[begin + i];
+			direction wo, wi;
+			float dist;
+			const float G = calc_G(c_isect, v.intersection(), wo, wi, dist);
+			if(G == 0){
+				continue;
+			}
+			idx[nC] = begin + i;
+			FG[nC] = v.Le_throughput() * (v.brdf().f(wo) * G);
+			ux[nC] = vec3(wi).x; uy[nC] = vec3(wi).y; uz[nC] = vec3(wi).z; t_max[nC] = dist * (1 - 1e-3f);
+			nC++;
+		}
+
+		//visibility test for V
+		bool occluded[batch_size];
+		scene.intersect(p0, ux, uy, uz, t_max, nC, occluded);
+		for(size_t k = 0; k < nC; k++){
+			if(occluded[k] == false){
+				weights[idx[k]] = luminance(FG[k]);
+			}
+		}
 	}
-	return col3();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
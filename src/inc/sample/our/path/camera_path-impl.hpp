@@ -8,9 +8,16 @@ namespace our{
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //construct eye sub-paths
-inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng)
+inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const size_t max_vertices)
+{
+	construct(scene, camera, x, y, rng, nullptr, max_vertices);
+}
+
+//construct eye sub-paths with at most max_vertices vertices (p_caches: cache points, nullptr if cache points are not available)
+inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> *p_caches, const size_t max_vertices)
 {
 	m_vertices.clear();
+	m_vertices.reserve(initial_path_capacity);
 
 	//number of samples for strategies (s>=1,t=1) (used in MIS weights)
 	m_ns1 = camera.res_x() * camera.res_y();
@@ -25,8 +32,17 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 	//initialize throughput*We
 	col3 throughput_We(1);
 
+	//set nearest cache points to path vertex
+	auto set_neighbor_caches = [&](camera_path_vertex &v, const neighbor_caches &caches){
+		if(p_caches != nullptr){
+			for(size_t j = 0; j < Nc; j++){
+				v.set_neighbor_cache(j, caches.neighbor_cache(j));
+			}
+		}
+	};
+
 	//generate path vertices
-	while(true){
+	while(num_vertices() < max_vertices){
 
 		const intersection isect = scene.calc_intersection(r);
 		if(isect.is_invalid()){
@@ -40,27 +56,36 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 
 		pdf *= wo.abs_cos() / (r.t() * r.t());
 
+		//search nearest cache points
+		const neighbor_caches caches = (p_caches != nullptr) ? neighbor_caches(*p_caches, isect.p()) : neighbor_caches();
+
 		//if isect is on light source, add isect and terminate tracing
 		if(isect.material().is_emissive()){
 			m_vertices.emplace_back(isect, brdf(), wo, direction(isect.n()), throughput_We, pdf);
+			set_neighbor_caches(m_vertices.back(), caches);
 			break;
 		}
 
+		//sample direction (guiding distributions at nearest cache points are used if available)
 		const brdf brdf = isect.material().make_brdf(isect, wo);
-		const brdf_sample sample = brdf.sample(rng);
+		const brdf_sample sample = (p_caches != nullptr) ? sample_guided(brdf, caches, isect.n(), rng) : brdf.sample(rng);
 
 		//add path vertex
 		if(sample.is_invalid()){
 			m_vertices.emplace_back(isect, brdf, wo, direction(), throughput_We, pdf);
+			set_neighbor_caches(m_vertices.back(), caches);
 			break;
 		}else{
 			m_vertices.emplace_back(isect, brdf, wo, sample.w(), throughput_We, pdf);
+			set_neighbor_caches(m_vertices.back(), caches);
 		}
 
 		//russian roulette
 		if(num_vertices() >= rr_threshold){
 			
-			const float q = rr_probability(sample.f(),  sample.w().abs_cos(), sample.pdf());
+			const float q = (p_caches != nullptr) ? 
+				rr_probability(sample.f(), sample.w().abs_cos(), sample.pdf(), m_vertices.back()) : 
+				rr_probability(sample.f(), sample.w().abs_cos(), sample.pdf());
 			if(rng.generate_uniform_real() < q){
 				pdf = sample.pdf() * q;
 			}else{
@@ -77,31 +102,19 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 }
 
 //construct eye sub-path
-inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches)
+inline void camera_path::construct(const scene &scene, const camera &camera, const int x, const int y, random_number_generator &rng, const kd_tree<cache> &caches, const size_t max_vertices, const bool calc_FGVc)
 {
-	//construct path
-	construct(scene, camera, x, y, rng);
+	//construct path (nearest cache points are searched during construction for russian roulette)
+	construct(scene, camera, x, y, rng, &caches, max_vertices);
 
 	//precompute variables used in MIS weights
 	{
-		//search nearest cache points
-		thread_local std::vector<neighbor<cache>> neighbors;
-		for(size_t i = 1, n = num_vertices(); i < n; i++){
-
-			auto &zi = operator()(i);
-			caches.find_nearest(zi.intersection().p(), FLT_MAX, Nc, neighbors);
-
-			for(size_t j = 0; j < Nc; j++){
-				zi.set_neighbor_cache(j, *neighbors[j]);
-			}
-		}
-
 		//calculate backward pdfs and FGV at neighbor cache points
 		for(size_t i = 1, n = num_vertices(); i + 2 < n; i++){
 		
 			auto &zi = operator()(i);
 			auto &zip1 = operator()(i + 1);
-			auto pdfs_FG = light_path::pdfs_FG(scene, zi, zip1, zi.FGVc());
+			auto pdfs_FG = light_path::pdfs_FG(scene, zi, zip1, zi.FGVc(), zi.GVc(), calc_FGVc);
 			zi.set_pdf_bwd(std::get<0>(pdfs_FG));
 			zi.set_pdf_bwd_rr(std::get<1>(pdfs_FG));
 			zi.set_FG_bwd(std::get<2>(pdfs_FG));
@@ -112,7 +125,8 @@ inline void camera_path::construct(const scene &scene, const camera &camera, con
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //calculate MIS partial weight
-inline float camera_path::mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp)
+//term of z(i-1) is for strategies with eye sub-paths of i vertices and light sub-paths of s+t-i vertices, and dropped if they are disabled
+inline float camera_path::mis_partial_weight(const scene &scene, const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float eta, const strategy_set &strategies)
 {
 	float w = 0;
 	{
@@ -120,12 +134,12 @@ inline float camera_path::mis_partial_weight(const scene &scene, const light_pat
 		{
 			//calculate FGV
 			std::array<col3, Nc> FGVc;
+			float pdf_L_zim1 = 0;
 			if(i > 1){
 				
 				col3 FG_zim1;
-				float pdf_L_zim1;
 				if(i == t - 1){
-					const auto pdf_FG = light_path::pdf_FG(scene, z(t - 2), z(t - 1), s + (t - (i - 1)), zy, FGVc);
+					const auto pdf_FG = light_path::pdf_FG(scene, z(t - 2), z(t - 1), s + (t - (i - 1)), zy, FGVc, strategies.resampling(s + t - i, i) && (strategies.connection == strategy_set::connect_resampled), strategies.cached_visibility);
 					pdf_L_zim1 = std::get<0>(pdf_FG);
 					FG_zim1 = std::get<1>(pdf_FG);
 
@@ -138,18 +152,16 @@ inline float camera_path::mis_partial_weight(const scene &scene, const light_pat
 			}
 			
 			if(i == 1){
-				w += z.m_ns1;
-			}else{
-				for(size_t j = 0; j < Nc; j++){
-			
-					const float Q = z(i - 1).neighbor_cache(j).Q();
-					const float Le_throughput_FGVc = luminance(Le_throughput * FGVc[j]);
-			
-					if(Le_throughput_FGVc > 0){
-						w += (1 / float(Nc + 1)) * M / ((M - 1) * std::max(mis_threshold, Q / Le_throughput_FGVc) + 1);
-					}
+				if(strategies.light_tracing(s + t - 1)){
+					w += z.m_ns1;
 				}
-				w += (1 / float(Nc + 1)) * M / ((M - 1) * Qp + 1);
+			}else if(strategies.resampling(s + t - i, i)){
+				w += connection_term(z(i - 1), [&](const size_t j){ return luminance(Le_throughput * FGVc[j]); }, M, Qp, strategies);
+			}
+
+			//vertex merging at z(i-1) (pdf ratio is eta * pdf of z(i-1) from light)
+			if((i > 1) && strategies.merging(s + t - i + 1, i)){
+				w += eta * pdf_L_zim1;
 			}
 			w *= pdf_L_zi / z(i).pdf_fwd();
 		};
@@ -178,8 +190,8 @@ inline std::tuple<float, float> camera_path::pdfs(const light_path_vertex &yi, c
 	const auto brdf = yip1_isect.material().make_brdf(yip1_isect, yip1.wo());
 
 	//pdf of solid angle measure
-	const float pdf_w = brdf.pdf(yip1.wi());
-	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(yip1.wi()), yip1.wi().abs_cos(), pdf_w);
+	const float pdf_w = pdf_guided(brdf, yip1, yip1.wi());
+	const float pdf_w_rr = pdf_w * rr_probability(brdf.f(yip1.wi()), yip1.wi().abs_cos(), pdf_w, yip1);
 
 	//convert to area measure
 	const float J = yi.wo().abs_cos() / squared_norm(yi_isect.p() - yip1_isect.p());
@@ -203,13 +215,13 @@ inline float camera_path::pdf(const light_path_vertex &ysm1, const camera_path_v
 {
 	float pdf_w;
 
-	if(n==1){
+	if(n == 2){ //z(t-1) on lens (y(s-1) is 2nd vertex from eye)
 		pdf_w = reinterpret_cast<const class camera&>(ztm1.intersection().material()).pdf_d(zy);
 	}
 	else{ //z(t-1) on surfaces
-		pdf_w = ztm1.brdf().pdf(zy);
+		pdf_w = pdf_guided(ztm1.brdf(), ztm1, zy);
 		if(n > rr_threshold){
-			pdf_w *= rr_probability(ztm1.brdf().f(zy), zy.abs_cos(), pdf_w);
+			pdf_w *= rr_probability(ztm1.brdf().f(zy), zy.abs_cos(), pdf_w, ztm1);
 		}
 	}
 
@@ -227,9 +239,9 @@ inline float camera_path::pdf(const light_path_vertex &ysm2, const light_path_ve
 	const auto brdf = ysm1_isect.material().make_brdf(ysm1_isect, yz);
 
 	//solid angle pdf
-	float pdf_w = brdf.pdf(ysm1.wi());
+	float pdf_w = pdf_guided(brdf, ysm1, ysm1.wi());
 	if(n > rr_threshold){
-		pdf_w *= rr_probability(brdf.f(ysm1.wi()), ysm1.wi().abs_cos(), pdf_w);
+		pdf_w *= rr_probability(brdf.f(ysm1.wi()), ysm1.wi().abs_cos(), pdf_w, ysm1);
 	}
 
 	//convert to area measure
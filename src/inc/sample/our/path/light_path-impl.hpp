@@ -7,85 +7,101 @@ namespace our{
 //light_path
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-//construct light sub-path
-inline void light_path::construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches)
+//construct light sub-path with at most max_vertices vertices
+inline void light_path::construct(const scene &scene, random_number_generator &rng, const kd_tree<cache> &caches, light_path_vertex_pool &pool, const size_t max_vertices, const bool calc_FGVc)
 {
-	m_vertices.clear();
-
-	//initialize m_vertices using "dummy" path vertex to avoid out of range access when MIS is calculated, ptr to scene is stored in material
-	m_vertices.emplace_back(intersection(vec3(), vec3(), reinterpret_cast<const material*>(&scene)), brdf(), direction(), direction(), col3(), 0.0f);
-
-	//sample point on light source
-	const sample_point lsample = scene.sample_light(rng);
-	if(lsample.is_invalid()){
-		return;
-	}
+	//vertices are generated in memory of each thread, and then copied to pool
+	thread_local std::vector<light_path_vertex> vertices;
+	vertices.clear();
+	vertices.reserve(initial_path_capacity);
+
+	//generate vertices (return from the lambda terminates the path)
+	[&](){
+		//initialize vertices using "dummy" path vertex to avoid out of range access when MIS is calculated, ptr to scene is stored in material
+		vertices.emplace_back(intersection(vec3(), vec3(), reinterpret_cast<const material*>(&scene)), brdf(), direction(), direction(), col3(), 0.0f);
+
+		//sample point on light source
+		const sample_point lsample = scene.sample_light(rng);
+		if(lsample.is_invalid()){
+			return;
+		}
 
-	//sample outgoing direction
-	const brdf lbrdf = lsample.material().make_brdf(lsample, direction(lsample.n()));
-	const brdf_sample bsample = lbrdf.sample(rng);
+		//sample outgoing direction
+		const brdf lbrdf = lsample.material().make_brdf(lsample, direction(lsample.n()));
+		const brdf_sample bsample = lbrdf.sample(rng);
 
-	//add path vertex
-	col3 Le_throughput = lsample.material().Me() / lsample.pdf();
-	if(bsample.is_invalid()){
-		m_vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), direction(), Le_throughput, lsample.pdf());
-		return;
-	}else{
-		m_vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), bsample.w(), Le_throughput, lsample.pdf());
-	}
+		//add path vertex
+		col3 Le_throughput = lsample.material().Me() / lsample.pdf();
+		if(bsample.is_invalid()){
+			vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), direction(), Le_throughput, lsample.pdf());
+			return;
+		}else{
+			vertices.emplace_back(lsample, lbrdf, direction(lsample.n()), bsample.w(), Le_throughput, lsample.pdf());
+		}
 
-	//generate path
-	float pdf = bsample.pdf();
-	ray r(lsample.p(), bsample.w());
-	while(true){
+		//generate path (vertices includes dummy vertex)
+		float pdf = bsample.pdf();
+		ray r(lsample.p(), bsample.w());
+		while(vertices.size() - 1 < max_vertices){
 	
-		//intersection test
-		const intersection isect = scene.calc_intersection(r);
-		if(isect.is_invalid()){
-			break;
-		}
+			//intersection test
+			const intersection isect = scene.calc_intersection(r);
+			if(isect.is_invalid()){
+				break;
+			}
 
-		const direction wi(-r.d(), isect.n());
-		if(wi.is_invalid()){
-			break;
-		}
+			const direction wi(-r.d(), isect.n());
+			if(wi.is_invalid()){
+				break;
+			}
 	
-		//convert to area measure
-		pdf *= wi.abs_cos() / (r.t() * r.t());
+			//convert to area measure
+			pdf *= wi.abs_cos() / (r.t() * r.t());
 	
-		//if isect is on light source terminate tracing
-		if(isect.material().is_emissive()){
-			break;
-		}
+			//if isect is on light source terminate tracing
+			if(isect.material().is_emissive()){
+				break;
+			}
 	
-		//sample direction
-		const brdf brdf = isect.material().make_brdf(isect, wi);
-		const brdf_sample sample = brdf.sample(rng);
+			//sample direction
+			const brdf brdf = isect.material().make_brdf(isect, wi);
+			const brdf_sample sample = brdf.sample(rng);
 
-		//add path vertex
-		if(sample.is_invalid()){
-			m_vertices.emplace_back(isect, brdf, wi, direction(), Le_throughput, pdf);
-			break;
-		}else{
-			m_vertices.emplace_back(isect, brdf, wi, sample.w(), Le_throughput, pdf);
-		}
+			//add path vertex
+			if(sample.is_invalid()){
+				vertices.emplace_back(isect, brdf, wi, direction(), Le_throughput, pdf);
+				break;
+			}else{
+				vertices.emplace_back(isect, brdf, wi, sample.w(), Le_throughput, pdf);
+			}
 
-		//russian roulette
-		if(num_vertices() >= rr_threshold){
+			//russian roulette
+			if(vertices.size() - 1 >= rr_threshold){
 			
-			const float q = rr_probability(sample.f(), sample.w().abs_cos(), sample.pdf());
-			if(rng.generate_uniform_real() < q){
-				pdf = sample.pdf() * q;
+				const float q = rr_probability(sample.f(), sample.w().abs_cos(), sample.pdf());
+				if(rng.generate_uniform_real() < q){
+					pdf = sample.pdf() * q;
+				}else{
+					break;
+				}
 			}else{
-				break;
+				pdf = sample.pdf();
 			}
-		}else{
-			pdf = sample.pdf();
+
+			//update ray/throughput weight
+			r = ray(isect.p(), sample.w());
+			Le_throughput *= sample.f() * sample.w().abs_cos() / pdf;
 		}
+	}();
 
-		//update ray/throughput weight
-		r = ray(isect.p(), sample.w());
-		Le_throughput *= sample.f() * sample.w().abs_cos() / pdf;
+	m_size = vertices.size();
+	mp_vertices = pool.allocate(m_size);
+	if(mp_vertices == nullptr){
+		m_overflow.assign(vertices.begin(), vertices.end());
+		mp_vertices = m_overflow.data();
+	}else{
+		std::copy(vertices.begin(), vertices.end(), mp_vertices);
+		std::vector<light_path_vertex>().swap(m_overflow); //release memory used before the pool was large enough
 	}
 
 	//precompute variables for MIS weights
@@ -112,7 +128,7 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 		}
 
 		//set q*/p
-		for(size_t i = 1, n = num_vertices(); i < n; i++){
+		for(size_t i = 1, n = calc_FGVc ? num_vertices() : 0; i < n; i++){
 		
 			auto &yi = operator()(i);
 			auto &yim1 = operator()(i - 1);
@@ -127,24 +143,23 @@ inline void light_path::construct(const scene &scene, random_number_generator &r
 ///////////////////////////////////////////////////////////////////////////////////////////////////}
 
 //calculate MIS partial weight (yz: direction from y(s-1) to z(t-1), zy: direction from z(t-1) to y(s-1), Qp: normalization factor for virtual cache point)
-inline float light_path::mis_partial_weight(const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp)
+//term of y(i) is for strategies with eye sub-paths of s+t-i vertices, and dropped if they are disabled
+inline float light_path::mis_partial_weight(const light_path &y, const size_t s, const camera_path &z, const size_t t, const direction &yz, const direction &zy, const float M, const float Qp, const float eta, const strategy_set &strategies)
 {
 	float w = 0;
 	for(size_t i = 0; i < s; i++){
 
 		if(i == 0){
-			w += 1;
-		}else{
-			for(size_t j = 0; j < Nc; j++){
+			if(strategies.unidirectional(s + t)){
+				w += 1;
+			}
+		}else if(strategies.resampling(i, s + t - i)){
+			w += connection_term(y(i), [&](const size_t j){ return y(i).Le_throughput_FGVc(j); }, M, Qp, strategies);
 
-				const float Q = y(i).neighbor_cache(j).Q();
-				const float Le_throughput_FGVc = y(i).Le_throughput_FGVc(j);
-					
-				if(Le_throughput_FGVc > 0){ 
-					w += (1 / float(Nc + 1)) * M / ((M - 1) * std::max(mis_threshold, Q / Le_throughput_FGVc) + 1);
-				}
+			//vertex merging at y(i) (pdf ratio is eta * pdf of y(i) from light)
+			if(strategies.merging(i + 1, s + t - i)){
+				w += eta * y(i).pdf_fwd();
 			}
-			w += (1 / float(Nc + 1)) * M / ((M - 1) * Qp + 1);
 		}
 		if(i == s - 1){
 			w *= camera_path::pdf(y(s - 1), z(t - 1), (s - i) + t, yz, zy);
@@ -162,7 +177,7 @@ inline float light_path::mis_partial_weight(const light_path &y, const size_t s,
 
 //return pdfs (without/with RR) and FG, and calculate FGV at neighbor cache points of z(i)
 //zi: z(i), zip1: z(i+1), FGVc: array to store FGVs
-inline std::tuple<float, float, col3> light_path::pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc)
+inline std::tuple<float, float, col3> light_path::pdfs_FG(const scene &scene, const camera_path_vertex &zi, const camera_path_vertex &zip1, std::array<col3, Nc> &FGVc, std::array<float, Nc> &GVc, const bool calc_FGVc)
 {
 	auto &zi_isect = zi.intersection();
 	auto &zip1_isect = zip1.intersection();
@@ -182,9 +197,10 @@ inline std::tuple<float, float, col3> light_path::pdfs_FG(const scene &scene, co
 	//calculate FG
 	const col3 FG = brdf.f(zip1.wo()) * (zip1.wo().abs_cos() * J);
 
-	//calculate FGV at neighbor cache points of z(i)
-	for(size_t i = 0; i < Nc; i++){
-		FGVc[i] = zi.neighbor_cache(i).calc_FGV(scene, zip1_isect, brdf);
+	//calculate FGV at neighbor cache points of z(i) (GV is kept for MIS weights)
+	for(size_t i = 0; calc_FGVc && (i < Nc); i++){
+		GVc[i] = zi.neighbor_cache(i).calc_GV(scene, zip1_isect);
+		FGVc[i] = zi.neighbor_cache(i).calc_FGV(zip1_isect, brdf, GVc[i]);
 	}
 	return std::make_tuple(pdf_A, pdf_A_rr, FG);
 }
@@ -201,7 +217,7 @@ inline float light_path::pdf(const camera_path_vertex &zi, const camera_path_ver
 
 //return pdf and FG and calculate FGV at cache points neighbor to z(t-2)
 //ztm2: z(t-2), ztm1: z(t-1), n: z(i) is n-th vertex from light source, zy: direction from z(t-1) to y(s-1), FGVc: array to store FGV
-inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc)
+inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const camera_path_vertex &ztm2, const camera_path_vertex &ztm1, const size_t n, const direction &zy, std::array<col3, Nc> &FGVc, const bool calc_FGVc, const bool cached_GV)
 {
 	//BRDF at z(t-1)
 	const auto &ztm1_isect = ztm1.intersection();
@@ -221,8 +237,18 @@ inline std::tuple<float, col3> light_path::pdf_FG(const scene &scene, const came
 	const col3 FG = brdf.f(ztm1.wo()) * (ztm1.wo().abs_cos() * J);
 
 	//calculate FGV at cache points neighbor to z(t-2)
-	for(size_t i = 0; i < Nc; i++){
-		FGVc[i] = ztm2.neighbor_cache(i).calc_FGV(scene, ztm1_isect, brdf);
+	//only F depends on y(s-1), so that GV is the same for all connections to z(t-1)
+	for(size_t i = 0; calc_FGVc && (i < Nc); i++){
+		const cache &c = ztm2.neighbor_cache(i);
+		if(cached_GV){
+			float &GV = ztm2.GVc()[i];
+			if(GV == -1){
+				GV = c.calc_GV(scene, ztm1_isect);
+			}
+			FGVc[i] = c.calc_FGV(ztm1_isect, brdf, GV);
+		}else{
+			FGVc[i] = c.calc_FGV(scene, ztm1_isect, brdf);
+		}
 	}
 	return std::make_tuple(pdf_A, FG);
 }
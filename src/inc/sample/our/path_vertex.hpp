@@ -140,9 +140,9 @@ public:
 	//isect: intersection point, brdf: brdf at isect, wo&wi outgoing&incident directions, throughput_We: throughput * importance / PDF,
 	camera_path_vertex(const intersection &isect, const brdf &brdf, const direction &wo, const direction &wi, const col3 &throughput_We, const float pdf) : m_brdf(brdf), m_isect(isect), m_wo(wo), m_wi(wi), m_throughput_We(throughput_We), m_pdf_fwd(pdf)
 	{
-		//initialize m_cache_ptrs & m_FGVc
+		//initialize m_cache_ptrs & m_FGVc & m_GVc
 		for(size_t i = 0; i < Nc; i++){
-			m_cache_ptrs[i] = nullptr; m_FGVc[i][0] = -1;
+			m_cache_ptrs[i] = nullptr; m_FGVc[i][0] = -1; m_GVc[i] = -1;
 		}
 		m_FG_bwd[0] = -1;
 		m_pdf_bwd = -1;
@@ -171,6 +171,13 @@ public:
 		return m_FGVc;
 	}
 
+	//return G(geo term) x V(visibility) between cache points and z(i+1) (-1 if not tested yet)
+	//(mutable, since it is also stored on demand while calculating MIS weights of const eye sub-paths)
+	std::array<float, Nc> &GVc() const
+	{
+		return m_GVc;
+	}
+
 	void set_FG_bwd(const col3 &FG_bwd)
 	{
 		m_FG_bwd = FG_bwd;
@@ -242,6 +249,7 @@ private:
 	float                m_pdf_bwd_rr;
 	const cache         *m_cache_ptrs[Nc];
 	std::array<col3, Nc> m_FGVc;
+	mutable std::array<float, Nc> m_GVc;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,4 +1,6 @@
+#include <chrono>
 #include <cstring>
+#include <filesystem>
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 namespace our{
@@ -9,121 +11,393 @@ namespace our{
 
 
 //constructor (M : number of pre-sampled light sub-paths, nt : number of threads)
-inline renderer::renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt) : m_M(M), m_nt(nt), m_sum(), m_ite()
+inline renderer::renderer(const scene &scene, const camera &camera, const size_t M, const size_t nt) : m_M(M), m_M_min(M), m_M_max(M), m_M_step(1.5f), m_efficiency(), m_nt(nt), m_pool(nt), m_adjoint_rr(), m_guiding(), m_sort_candidates(), m_quantized_pmfs(), m_strategies(), m_max_cluster_size(1), m_vm_radius0(), m_vm_radius(), m_vm_eta(), m_memory_budget(), m_M_budget(SIZE_MAX), m_cache_density(cache_density), m_budget_clustering(), m_streaming(), m_mean_light_vertices(), m_caches_per_path(), m_representative_ratio(), m_num_preview_levels(), m_is_preview(), m_Qp(), m_sum(), m_ite(), m_allocations(), m_times(), m_rays(), m_total_rays(), m_strategy_split(split_none), m_strategy_costs(), m_total_strategy_costs()
 {
+	resize(camera.res_x(), camera.res_y());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//resize buffers for w x h image (nothing is done if the resolution does not change)
+inline void renderer::resize(const int w, const int h)
+{
+	if((m_albedo.width() == w) && (m_albedo.height() == h)){
+		return;
+	}
+
 	//number of samples for strategies (s>=1, t=1)
-	m_ns1 = camera.res_x() * camera.res_y();
+	m_ns1 = w * h;
 
 	//buffer to store contributions of strategies (s>=1, t=1)
-	m_buf_s1 = imagef(camera.res_x(), camera.res_y());
+	m_buf_s1 = imagef(w, h);
+
+	//feature buffers for denoising
+	m_albedo = imagef(w, h);
+	m_normal = imagef(w, h);
 
 	//spinlock
-	m_locks = std::make_unique<spinlock[]>(camera.res_x() * camera.res_y());
+	m_locks = std::make_unique<spinlock[]>(w * h);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return number of per-strategy buffers (0 if disabled)
+inline size_t renderer::num_strategy_buffers() const
+{
+	switch(m_strategy_split){
+	case split_group:
+		return num_strategy_groups;
+	case split_st:
+		return num_strategy_lengths * num_strategy_lengths + 1;
+	default:
+		return 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return name of per-strategy buffer idx
+inline std::string renderer::strategy_buffer_name(const size_t idx) const
+{
+	if(m_strategy_split == split_group){
+		return strategy_group_name(strategy_group_t(idx));
+	}
+	if(idx == num_strategy_lengths * num_strategy_lengths){
+		return strategy_group_name(group_vm);
+	}
+	const size_t s = idx / num_strategy_lengths;
+	const size_t t = idx % num_strategy_lengths;
+	const char *plus_s = (s == num_strategy_lengths - 1) ? "+" : "";
+	const char *plus_t = (t == num_strategy_lengths - 1) ? "+" : "";
+	return "s" + std::to_string(s) + plus_s + "_t" + std::to_string(t) + plus_t;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//enable adaptive M (M is chosen in [M_min, M_max])
+inline void renderer::set_adaptive_M(const size_t M_min, const size_t M_max)
+{
+	assert((0 < M_min) && (M_min <= M_max));
+	m_M_min = M_min;
+	m_M_max = M_max;
+	m_M = std::min(std::max(m_M, M_min), M_max);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //rendering
 inline imagef renderer::render(const scene &scene, const camera &camera)
+{
+	imagef screen;
+	render(scene, camera, screen);
+	return screen;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//rendering into screen
+//preview iterations are rendered at reduced resolution and M, and enlarged to the resolution of camera
+inline void renderer::render(const scene &scene, const camera &camera, imagef &screen)
+{
+	if(m_memory_budget > 0){
+		apply_memory_budget(camera.res_x(), camera.res_y());
+	}
+
+	const size_t level = (m_ite < m_num_preview_levels) ? m_num_preview_levels - size_t(m_ite) : 0;
+	m_is_preview = (level > 0);
+	if(m_is_preview == false){
+		render_iteration(scene, camera, screen);
+		return;
+	}
+
+	const int w = camera.res_x();
+	const int h = camera.res_y();
+	const int pw = std::max(w >> level, 1);
+	const int ph = std::max(h >> level, 1);
+	const ::camera preview_camera(camera.p(), camera.p() + camera.d(), pw, ph, camera.fovy(), camera.lens_radius());
+
+	const size_t M = m_M;
+	m_M = std::max(M >> level, size_t(1));
+	render_iteration(scene, preview_camera, m_preview);
+	m_M = M;
+
+	//enlarge preview (nearest neighbor)
+	if((screen.width() != w) || (screen.height() != h)){
+		screen = imagef(w, h);
+	}
+	for(int y = 0; y < h; y++){
+		for(int x = 0; x < w; x++){
+			const int px = std::min(x * pw / w, pw - 1);
+			const int py = std::min(y * ph / h, ph - 1);
+			for(int i = 0; i < 3; i++){
+				screen(x, y)[i] = m_preview(px, py)[i];
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//rendering an iteration into screen at resolution of camera
+//all per-iteration structures keep their memory, so that iterations after warm-up do not allocate heap memory
+//(buffers are reallocated only when the resolution changes, e.g., after preview iterations)
+inline void renderer::render_iteration(const scene &scene, const camera &camera, imagef &screen)
 {
 	m_ite += 1;
+	m_allocations.fill(0);
+	m_times.fill(0);
+	m_rays.fill(ray_count{ 0, 0 });
+
+	const auto start = std::chrono::steady_clock::now();
 
 	const int w = camera.res_x();
 	const int h = camera.res_y();
-	imagef screen(w, h);
+	if((screen.width() != w) || (screen.height() != h)){
+		screen = imagef(w, h);
+	}
+	memset(screen.data(), 0, sizeof(float) * screen.size());
+	resize(w, h);
+
+	//M is fixed during each iteration, so that all MIS weights (including m_Qp) use the same M
+	//M cannot exceed the number of light sub-paths
+	m_M = std::min(m_M, size_t(w * h));
 
 	//generate cache points (Line 3 of Algorithm1)
 	{
+		const stage_scope scope(*this, stage_caches);
+
 		std::mutex mtx;
-		std::vector<cache> caches;
+		m_new_caches.clear();
 		auto locked_add = [&](const camera_path_vertex &v){
-			std::lock_guard<std::mutex> lock(mtx); caches.emplace_back(v, m_ite == 1);
+			std::lock_guard<std::mutex> lock(mtx); m_new_caches.emplace_back(v, m_ite == 1);
 		};
 
 		//camera setup for generating cache points
-		//generate eye sub-paths from camera_for_gen_caches (with approximately wxhx0.4% pixels)
-		const float num = w * h * 0.004f;
+		//generate eye sub-paths from camera_for_gen_caches (with approximately wxhx0.4% pixels, or fewer to meet memory budget)
+		const float num = w * h * m_cache_density;
 		const int res_x = int(ceil(sqrt(num * camera.res_x() / float(camera.res_y()))));
 		const int res_y = int(ceil(sqrt(num * camera.res_y() / float(camera.res_x()))));
 		const ::camera camera_for_gen_caches(camera.p(), camera.p() + camera.d(), res_x, res_y, camera.fovy(), camera.lens_radius());
 
+		//the number of cache points fluctuates between iterations
+		reserve_with_headroom(m_new_caches, m_caches.end() - m_caches.begin());
+
 		//cache points are generated by tracing eye sub-paths. Each vertex of the eye sub-paths are used as the cache point
-		std::atomic_size_t idx(0);
-		in_parallel(res_x, res_y, [&](const int x, const int y)
+		//(eye sub-paths are capped as in rendering, but reach z(1) so that cache points exist for light sub-path vertices)
+		const size_t max_vertices = std::max(m_strategies.max_t, size_t(2));
+		m_pool.run(res_x, res_y, [&](const int x, const int y)
 		{
 			thread_local random_number_generator rng(std::random_device{}());
 			thread_local camera_path z;
 
 			if(m_ite == 1){
                 //for 1st iteration, estimate normalization factor Q using pre-sampled light sub-paths of 1st iteration
-				z.construct(scene, camera_for_gen_caches, x, y, rng);
+				z.construct(scene, camera_for_gen_caches, x, y, rng, max_vertices);
 			}else{
                 //estimate normalization factor Q using cache points at previous iteration (m_caches)
-				z.construct(scene, camera_for_gen_caches, x, y, rng, m_caches);
+				z.construct(scene, camera_for_gen_caches, x, y, rng, m_caches, max_vertices);
 			}
 			for(size_t j = 1, n = z.num_vertices(); j < n; j++){
 				locked_add(std::move(std::move(z(j)))); //generation of cache points for current iteration
 			}
-		}, m_nt);
+		});
+		m_caches_per_path = m_new_caches.size() / float(res_x * res_y);
 
 		//construct kd-tree to search cache points
-		m_caches = kd_tree<cache>(std::move(caches), [](const cache &c) -> const vec3&{
+		m_caches.build(m_new_caches, [](const cache &c) -> const vec3&{
 			return c.intersection().p();
 		});
 	}
 
+	//group cache points into clusters sharing resampling pmfs
+	{
+		const stage_scope scope(*this, stage_caches);
+		cluster_caches();
+	}
+
+	//set ratio of Q to average Q for adjoint-driven russian roulette
+	//(for 1st iteration, Q is not available until resampling pmfs are constructed)
+	if(m_adjoint_rr && (m_ite > 1)){
+		double sum = 0;
+		for(const cache &c : m_caches){
+			sum += c.Q();
+		}
+		const float Q_avg = float(sum / (m_caches.end() - m_caches.begin()));
+		if(Q_avg > 0){
+			for(const cache &c : m_caches){
+				const_cast<cache&>(c).set_rr_adjoint(std::max(c.Q() / Q_avg, rr_min_adjoint));
+			}
+		}
+	}
+
+	//candidates and resampling pmfs are constructed only if resampling strategies are enabled (e.g., not for baselines)
+	const bool resampling = m_strategies.uses_resampling();
+
 	//generate light sub-paths
 	//we prepare wxh light sub-paths and each light sub-path is used for strategies other than resampling strategies.
-	m_light_paths.resize(w * h);
-	in_parallel(w * h, [&](const int idx)
+	//(if light tracing and vertex merging are disabled, only M light sub-paths for candidates are generated)
 	{
-		thread_local random_number_generator rng(std::random_device{}());
-		m_light_paths[idx].construct(scene, rng, m_caches);
-	}, m_nt);
+		const stage_scope scope(*this, stage_light_paths);
+
+		//vertex pool is sized from the mean number of vertices in previous iteration (typical number is assumed in 1st iteration)
+		//(vertices of sub-paths that do not fit into the pool are stored in the sub-paths, and unused pages of the pool are not resident)
+		const size_t num_paths = num_light_paths(w, h, m_M);
+		const float L = (m_mean_light_vertices > 0) ? m_mean_light_vertices : typical_light_path_vertices;
+		const size_t num_vertices = size_t(num_paths * (L + 1)); //including dummy vertices
+		m_light_path_vertices.reset(num_vertices + num_vertices / 4, m_streaming ? scratch_file("light_path_vertices.bin") : std::string());
+
+		m_light_paths.resize(num_paths);
+		m_pool.run(int(num_paths), [&](const int idx)
+		{
+			thread_local random_number_generator rng(std::random_device{}());
+			m_light_paths[idx].construct(scene, rng, m_caches, m_light_path_vertices, m_strategies.max_s, resampling);
+		});
+		m_mean_light_vertices = m_light_path_vertices.requested() / float(num_paths) - 1;
+
+		//construct kd-tree of light sub-path vertices for vertex merging
+		//y(0) is on light source, and eye sub-path vertices on light sources are not merged
+		if(m_vm_radius0 > 0){
+			m_vm_radius = m_vm_radius0 * pow(float(m_ite), (vm_alpha - 1) / 2);
+			m_vm_eta = (w * h) * PI() * m_vm_radius * m_vm_radius;
+
+			size_t num = 0;
+			for(const light_path &y : m_light_paths){
+				num += std::max(y.num_vertices(), size_t(1)) - 1;
+			}
+			m_vm_elems.clear();
+			reserve_with_headroom(m_vm_elems, num);
+			for(const light_path &y : m_light_paths){
+				for(size_t j = 1, n = y.num_vertices(); j < n; j++){
+					m_vm_elems.emplace_back(y, j);
+				}
+			}
+			m_vm_vertices.build(m_vm_elems, [](const candidate &c) -> const vec3&{
+				return c.vertex().intersection().p();
+			});
+		}
+	}
 
 	//generate ¥hat{Y}_n in Line 2 of Algorithm1
 	{
+		const stage_scope scope(*this, stage_candidates);
+
+		const size_t M = resampling ? m_M : 0;
 		size_t V = 0;
-		for(size_t i = 0; i < m_M; i++){
+		for(size_t i = 0; i < M; i++){
 			V += m_light_paths[i].num_vertices();
 		}
+		reserve_with_headroom(m_candidates, V);
 		m_candidates.resize(V);
 
 		V = 0;
-		for(size_t i = 0; i < m_M; i++){
+		for(size_t i = 0; i < M; i++){
 			for(size_t j = 0, n = m_light_paths[i].num_vertices(); j < n; j++){
 				m_candidates[V++] = candidate(m_light_paths[i], j);
 			}
 		}
+
+		//cdfs and indices of sampled candidates (sample_idx in calculate_st) refer to candidates in this order
+		if(m_sort_candidates){
+			sort_candidates();
+		}
+	}
+
+	//copy vertices of candidates to candidate vertex table and allocate cdfs of resampling pmfs
+	//layout: candidate vertex table is sorted by candidate, and cdfs are sorted by representative and then by candidate,
+	//so that each cache point reads the table and writes its cdf sequentially during pmf construction,
+	//and resampling at a cache point only touches its own cdf
+	const size_t V = m_candidates.size();
+	const size_t num_representatives = resampling ? m_representatives.size() : 0;
+	const size_t cdf_size = distribution_view<candidate>::storage_size(V, m_quantized_pmfs);
+	{
+		const stage_scope scope(*this, stage_pmfs);
+
+		const bool out_of_core = !m_scratch_dir.empty() || m_streaming;
+		m_candidate_vertices.allocate(V, out_of_core ? scratch_file("candidate_vertices.bin") : std::string());
+		m_pmfs.allocate(num_representatives * cdf_size, out_of_core ? scratch_file("pmfs.bin") : std::string());
+		if(m_memory_budget > 0){
+			m_candidate_vertices.release_unused();
+			m_pmfs.release_unused();
+		}
+
+		for(size_t i = 0; i < V; i++){
+			m_candidate_vertices[i] = m_candidates[i].vertex();
+		}
+		m_candidate_vertices.advise_sequential();
+		m_pmfs.advise_sequential();
 	}
 
 	//construct resampling pmfs at cache points
-	in_parallel(int(m_caches.end() - m_caches.begin()), [&](const int idx)
+	const auto start_pmf = std::chrono::steady_clock::now();
 	{
-		const cache &c = *(m_caches.begin() + idx);
-		const_cast<cache&>(c).calc_distribution(scene, m_candidates, m_M);
-	}, m_nt);
+		const stage_scope scope(*this, stage_pmfs);
+
+		m_pool.run(int(num_representatives), [&](const int idx)
+		{
+			cache &c = *m_representatives[idx];
+			c.calc_distribution(scene, m_candidates.data(), m_candidate_vertices.data(), V, m_M, m_pmfs.data() + idx * cdf_size, m_sort_candidates, m_quantized_pmfs);
+
+			//guiding distributions are used for eye sub-paths in next iteration
+			if(m_guiding){
+				c.calc_guide();
+			}
+		});
+
+		//the other cache points in clusters only estimate their Z
+		m_pool.run(resampling ? int(m_members.size()) : 0, [&](const int idx)
+		{
+			cache &c = *m_members[idx];
+			c.share_distribution(scene, m_candidate_vertices.data(), m_M);
+
+			if(m_guiding){
+				c.calc_guide();
+			}
+		});
+	}
+	const double time_pmf = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_pmf).count();
+	m_pmfs.advise_random();
 
 	//calculate normalization factor for virtual cache point
-	{
+	if(resampling){
 		m_sum += m_candidates.size() / double(m_M);
 		m_Qp = float(m_sum / m_ite);
 	}
 
 	//initialize buffer that stores contributions of strategies (s>=1,t=1) of light tracing
-	memset(m_buf_s1(0,0), 0, sizeof(float) * 3 * w * h);
+	memset(m_buf_s1.data(), 0, sizeof(float) * m_buf_s1.size());
+
+	//initialize per-strategy buffers and statistics of groups of strategies
+	m_strategy_buffers.resize(num_strategy_buffers());
+	for(auto &buf : m_strategy_buffers){
+		if((buf.width() != w) || (buf.height() != h)){
+			buf = imagef(w, h);
+		}
+		memset(buf.data(), 0, sizeof(float) * buf.size());
+	}
+	std::array<strategy_cost, num_strategy_groups> strategy_start;
+	for(size_t g = 0; g < num_strategy_groups; g++){
+		strategy_start[g] = strategy_cost{ double(m_strategy_time[g].value()), m_strategy_shadow_rays[g].value() };
+	}
+
+	if(m_M_min != m_M_max){
+		m_lum_st.resize(w * h);
+	}
 
-	in_parallel(w, h, [&](const int x, const int y)
 	{
-		thread_local random_number_generator rng(std::random_device{}());
+		const stage_scope scope(*this, stage_radiance);
 
-		const col3 col = radiance(x, y, scene, camera, rng);
-		if(!(std::isnan(col[0] + col[1] + col[2]))){
-			screen(x, y)[0] = col[0];
-			screen(x, y)[1] = col[1];
-			screen(x, y)[2] = col[2];
-		}
-	}, m_nt);
+		m_pool.run(w, h, [&](const int x, const int y)
+		{
+			thread_local random_number_generator rng(std::random_device{}());
+
+			const col3 col = radiance(x, y, scene, camera, rng);
+			if(!(std::isnan(col[0] + col[1] + col[2]))){
+				screen(x, y)[0] = col[0];
+				screen(x, y)[1] = col[1];
+				screen(x, y)[2] = col[2];
+			}
+		});
+	}
 
 	//add contributions of strategies (s>=1,t=1)
 	const float inv_ns1 = 1 / float(m_ns1);
@@ -134,7 +408,330 @@ inline imagef renderer::render(const scene &scene, const camera &camera)
 			screen(x, y)[2] += m_buf_s1(x, y)[2] * inv_ns1;
 		}
 	}
-	return screen;
+	for(size_t g = 0; g < num_strategy_groups; g++){
+		m_strategy_costs[g].time = (m_strategy_time[g].value() - strategy_start[g].time) * 1e-9;
+		m_strategy_costs[g].shadow_rays = m_strategy_shadow_rays[g].value() - strategy_start[g].shadow_rays;
+	}
+
+	//accumulate per-strategy buffers and statistics of full-resolution iterations
+	//(sums are allocated in the first full-resolution iteration)
+	if((m_strategy_split != split_none) && (m_is_preview == false)){
+		m_strategy_sums.resize(m_strategy_buffers.size());
+		for(size_t k = 0; k < m_strategy_buffers.size(); k++){
+			if((m_strategy_sums[k].width() != w) || (m_strategy_sums[k].height() != h)){
+				m_strategy_sums[k] = imagef(w, h);
+			}
+			float *sum = m_strategy_sums[k].data();
+			const float *buf = m_strategy_buffers[k].data();
+			for(size_t i = 0, n = m_strategy_sums[k].size(); i < n; i++){
+				sum[i] += buf[i];
+			}
+		}
+		for(size_t g = 0; g < num_strategy_groups; g++){
+			m_total_strategy_costs[g].time += m_strategy_costs[g].time;
+			m_total_strategy_costs[g].shadow_rays += m_strategy_costs[g].shadow_rays;
+		}
+	}
+	for(size_t i = 0; i < num_stages; i++){
+		m_total_rays[i].closest_hit += m_rays[i].closest_hit;
+		m_total_rays[i].shadow += m_rays[i].shadow;
+	}
+
+	//choose M for next iteration (M of preview iterations is not adapted)
+	if((m_M_min != m_M_max) && (m_is_preview == false)){
+		update_M(w, h, time_pmf, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//sort m_candidates by 6D Morton code of position (10 bits per axis in bounding box of candidates) and normal of their vertices
+inline void renderer::sort_candidates()
+{
+	aabb box;
+	for(const candidate &c : m_candidates){
+		const vec3 &p = c.vertex().intersection().p();
+		box.expand(aabb(p, p));
+	}
+	const vec3 extent = box.max() - box.min();
+	const vec3 scale(
+		1023 / std::max(extent.x, FLT_MIN),
+		1023 / std::max(extent.y, FLT_MIN),
+		1023 / std::max(extent.z, FLT_MIN)
+	);
+
+	m_sorted_candidates.clear();
+	reserve_with_headroom(m_sorted_candidates, m_candidates.size());
+	for(const candidate &c : m_candidates){
+		const vec3 p = (c.vertex().intersection().p() - box.min()) * scale;
+		const vec3 n = (c.vertex().intersection().n() + vec3(1, 1, 1)) * 511.5f;
+		const uint32_t code_p = morton_encode(uint32_t(p.x), uint32_t(p.y), uint32_t(p.z));
+		const uint32_t code_n = morton_encode(uint32_t(n.x), uint32_t(n.y), uint32_t(n.z));
+		m_sorted_candidates.emplace_back(morton_interleave3(code_p, code_n), c);
+	}
+	std::sort(m_sorted_candidates.begin(), m_sorted_candidates.end(), [](const auto &a, const auto &b){
+		return (a.first < b.first);
+	});
+	for(size_t i = 0, n = m_candidates.size(); i < n; i++){
+		m_candidates[i] = m_sorted_candidates[i].second;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//group cache points into clusters
+//each unclustered cache point becomes a representative, and its unclustered nearest cache points with similar normals join its cluster
+inline void renderer::cluster_caches()
+{
+	const size_t num_caches = m_caches.end() - m_caches.begin();
+	const size_t max_cluster_size = m_budget_clustering ? std::max(m_max_cluster_size, budget_cluster_size) : m_max_cluster_size;
+	m_representatives.clear();
+	m_members.clear();
+	reserve_with_headroom(m_representatives, num_caches);
+	reserve_with_headroom(m_members, num_caches);
+
+	thread_local std::vector<neighbor<cache>> neighbors;
+	for(auto it = m_caches.begin(); it != m_caches.end(); ++it){
+
+		cache &c = const_cast<cache&>(static_cast<const cache&>(*it));
+		if(c.is_clustered()){
+			continue;
+		}
+		c.set_representative(c);
+		m_representatives.push_back(&c);
+
+		if(max_cluster_size > 1){
+			const vec3 n = c.intersection().n();
+			m_caches.find_nearest(c.intersection().p(), FLT_MAX, max_cluster_size, neighbors);
+			for(const auto &neighbor : neighbors){
+				cache &m = const_cast<cache&>(*neighbor);
+				if((m.is_clustered() == false) && (dot(m.intersection().n(), n) >= cluster_cos_threshold)){
+					m.set_representative(c);
+					m_members.push_back(&m);
+				}
+			}
+		}
+	}
+	if((max_cluster_size > 1) && (num_caches > 0)){
+		m_representative_ratio = m_representatives.size() / float(num_caches);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return number of light sub-paths generated in an iteration for w x h image with M pre-sampled light sub-paths
+//light tracing, vertex merging and connections of standard BPT use w x h light sub-paths, and resampling strategies use only the first M of them
+inline size_t renderer::num_light_paths(const int w, const int h, const size_t M) const
+{
+	const size_t num_pixels = size_t(w) * h;
+	const bool per_pixel = m_strategies.s1 || (m_vm_radius0 > 0) || (m_strategies.connection == strategy_set::connect_light_path);
+	return per_pixel ? num_pixels : std::min(M, num_pixels);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//write metrics of the renderer in Prometheus text format
+inline void renderer::write_metrics(prometheus_writer &writer, const double time) const
+{
+	writer.family("ris_bpt_stage_seconds", "gauge", "Time of each stage of the last iteration.");
+	for(int i = 0; i < num_stages; i++){
+		writer.sample(m_times[i], std::string("stage=\"") + stage_name(stage_t(i)) + "\"");
+	}
+	writer.family("ris_bpt_rays_total", "counter", "Number of rays traced in each stage.");
+	ray_count iteration_rays = { 0, 0 };
+	for(int i = 0; i < num_stages; i++){
+		const std::string stage = std::string("stage=\"") + stage_name(stage_t(i)) + "\"";
+		writer.sample(double(m_total_rays[i].closest_hit), stage + ",type=\"closest_hit\"");
+		writer.sample(double(m_total_rays[i].shadow), stage + ",type=\"shadow\"");
+		iteration_rays.closest_hit += m_rays[i].closest_hit;
+		iteration_rays.shadow += m_rays[i].shadow;
+	}
+	writer.family("ris_bpt_rays_per_second", "gauge", "Rays per second in the last iteration.");
+	writer.sample(iteration_rays.closest_hit / time, "type=\"closest_hit\"");
+	writer.sample(iteration_rays.shadow / time, "type=\"shadow\"");
+	writer.family("ris_bpt_knn_lookups_total", "counter", "Number of kNN lookups of cache points.");
+	writer.sample(double(num_knn_lookups.value()));
+	writer.family("ris_bpt_knn_lookup_seconds_total", "counter", "Time of kNN lookups summed over threads (estimated from sampled lookups).");
+	writer.sample(knn_sampled_nanoseconds.value() * 1e-9 * knn_sample_interval);
+	if(m_strategy_split != split_none){
+		writer.family("ris_bpt_strategy_seconds_total", "counter", "Time of each group of strategies summed over threads and accumulated iterations.");
+		for(int i = 0; i < num_strategy_groups; i++){
+			writer.sample(m_total_strategy_costs[i].time, std::string("group=\"") + strategy_group_name(strategy_group_t(i)) + "\"");
+		}
+		writer.family("ris_bpt_strategy_shadow_rays_total", "counter", "Number of shadow rays of each group of strategies in accumulated iterations.");
+		for(int i = 0; i < num_strategy_groups; i++){
+			writer.sample(double(m_total_strategy_costs[i].shadow_rays), std::string("group=\"") + strategy_group_name(strategy_group_t(i)) + "\"");
+		}
+	}
+	writer.family("ris_bpt_cache_points", "gauge", "Number of cache points in the last iteration.");
+	writer.sample(double(num_caches()));
+	writer.family("ris_bpt_representatives", "gauge", "Number of cache points constructing resampling pmfs in the last iteration.");
+	writer.sample(double(num_representatives()));
+	writer.family("ris_bpt_candidates", "gauge", "Number of candidates (vertices of the M pre-sampled light sub-paths) in the last iteration.");
+	writer.sample(double(num_candidates()));
+	writer.family("ris_bpt_M", "gauge", "Number of pre-sampled light sub-paths for the next iteration.");
+	writer.sample(double(m_M));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return path of scratch file name in the scratch directory (or in the temporary directory if streaming is chosen to meet memory budget)
+//mapped_array appends a unique suffix to the path, so that concurrent jobs sharing the directory use separate files
+inline std::string renderer::scratch_file(const char *name) const
+{
+	const std::string dir = m_scratch_dir.empty() ? std::filesystem::temp_directory_path().string() : m_scratch_dir;
+	return dir + "/" + name;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//return projected number of resident bytes of per-iteration structures for w x h image
+//(M: number of pre-sampled light sub-paths, density: number of eye sub-paths per pixel for generating cache points)
+//structures in scratch files are not counted, since the OS writes their pages back to the files instead of keeping them in RAM
+inline size_t renderer::projected_footprint(const int w, const int h, const size_t M, const float density, const bool clustering, const bool streaming) const
+{
+	const double L = (m_mean_light_vertices > 0) ? m_mean_light_vertices : typical_light_path_vertices;
+	const double N = (m_caches_per_path > 0) ? m_caches_per_path : typical_caches_per_path;
+	const double R = clustering ? ((m_representative_ratio > 0) ? m_representative_ratio : typical_representative_ratio) : 1.0;
+
+	const double P = double(w) * h;    //number of pixels
+	const double Y = double(num_light_paths(w, h, M)); //number of light sub-paths
+	const double V = M * L;            //number of candidates
+	const double C = P * density * N;  //number of cache points
+
+	double bytes = 0;
+	bytes += Y * sizeof(light_path);
+	bytes += P * sizeof(float) * (4 * 3 + 1); //screen, m_buf_s1, m_albedo, m_normal and m_lum_st
+	bytes += V * sizeof(candidate);
+	bytes += C * (2 * sizeof(cache) + sizeof(cache*)); //cache points of previous and current iterations, m_representatives/m_members
+	if(streaming == false){
+		bytes += Y * (L + 1) * sizeof(light_path_vertex); //vertex pool (including dummy vertices)
+	}
+	if((streaming == false) && m_scratch_dir.empty()){
+		bytes += V * sizeof(light_path_vertex) + R * C * distribution_view<candidate>::storage_size(size_t(V), m_quantized_pmfs) * sizeof(float); //candidate vertex table and cdfs
+	}
+	if(m_vm_radius0 > 0){
+		bytes += P * std::max(L - 1, 0.0) * 3 * sizeof(candidate); //m_vm_elems and kd-tree of them
+	}
+	return size_t(bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//choose M, cache density, clustering and streaming so that the projected footprint for w x h image fits into memory budget
+//the choice starts from the settings of the user in each iteration, so that it follows the measured statistics
+inline void renderer::apply_memory_budget(const int w, const int h)
+{
+	const bool user_clustering = (m_max_cluster_size > 1);
+	const size_t M_max = std::min(m_M_max, size_t(w * h));
+	const size_t M_min = std::min(budget_min_M, M_max);
+	const float density_min = std::min(budget_min_cache_density, cache_density);
+
+	size_t M = M_max;
+	float density = cache_density;
+	bool clustering = false;
+	bool streaming = false;
+	auto fits = [&](){
+		return (projected_footprint(w, h, M, density, user_clustering || clustering, streaming) <= m_memory_budget);
+	};
+
+	//share resampling pmfs between clustered cache points (sparse pmfs)
+	if((fits() == false) && (user_clustering == false)){
+		clustering = true;
+	}
+
+	//place vertex pool, candidate vertex table and cdfs in scratch files if reducing M and cache density does not suffice
+	//(the vertex pool of w x h light sub-paths does not depend on M)
+	M = M_min, density = density_min;
+	if(fits() == false){
+		streaming = true;
+	}
+	density = cache_density;
+
+	//largest M which fits (the footprint grows linearly in M)
+	{
+		size_t lo = M_min, hi = M_max;
+		while(lo < hi){
+			M = (lo + hi + 1) / 2;
+			if(fits()){
+				lo = M;
+			}else{
+				hi = M - 1;
+			}
+		}
+		M = lo;
+	}
+
+	//largest cache density which fits
+	if(fits() == false){
+		float lo = density_min, hi = cache_density;
+		for(int i = 0; i < 16; i++){
+			density = (lo + hi) / 2;
+			if(fits()){
+				lo = density;
+			}else{
+				hi = density;
+			}
+		}
+		density = lo;
+	}
+
+	const bool changed = (M != m_M_budget) || (density != m_cache_density) || (clustering != m_budget_clustering) || (streaming != m_streaming);
+	m_M_budget = M;
+	m_cache_density = density;
+	m_budget_clustering = clustering;
+	m_streaming = streaming;
+	//M is lowered to the budget, and recovers up to M of the user when the budget allows it again (e.g., after the measured statistics shrink)
+	//adaptive M is only clamped, since update_M keeps it within the budget and increases it when it pays off
+	m_M = (m_M_min == m_M_max) ? std::min(m_M_max, m_M_budget) : std::min(m_M, m_M_budget);
+
+	if(changed){
+		const double MB = 1024.0 * 1024.0;
+		std::cout << "memory budget = " << m_memory_budget / MB << "MB: M <= " << M << ", cache density = " << density;
+		std::cout << (clustering ? ", clustering of cache points" : "") << (streaming ? ", streaming to scratch files" : "");
+		std::cout << " (projected footprint = " << projected_footprint(w, h, M, density, user_clustering || clustering, streaming) / MB << "MB)" << std::endl;
+		if(fits() == false){
+			std::cout << "memory budget cannot be met (light sub-paths and framebuffers exceed it)" << std::endl;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//choose M for next iteration from resampling efficiency 1/(variance*time) of current iteration
+inline void renderer::update_M(const int w, const int h, const double time_pmf, const double time)
+{
+	//variance of resampling estimators is estimated from differences between horizontally adjacent pixels
+	//(the differences cancel most of image structure, i.e., 0.5*E[(L(x+1,y)-L(x,y))^2] is approximately the variance)
+	double sum = 0;
+	size_t num = 0;
+	for(int y = 0; y < h; y++){
+		for(int x = 0; x + 1 < w; x++){
+			const double diff = double(m_lum_st[x + 1 + w * y]) - m_lum_st[x + w * y];
+			if(std::isfinite(diff)){
+				sum += diff * diff; num++;
+			}
+		}
+	}
+	const double variance = (num > 0) ? 0.5 * sum / num : 0;
+
+	//the cost of pmf construction grows linearly in M, while the variance decreases
+	//hill climbing on log(M): keep the direction while the efficiency improves, otherwise reverse it
+	const size_t M = m_M;
+	if(variance > 0){
+		const double efficiency = 1 / (variance * time);
+		if(efficiency < m_efficiency){
+			m_M_step = 1 / m_M_step;
+		}
+		m_efficiency = efficiency;
+
+		const size_t M_max = std::min({ m_M_max, size_t(w * h), m_M_budget });
+		m_M = std::min(std::max(size_t(M * m_M_step + 0.5f), m_M_min), M_max);
+		if((m_M == M) && (M_max != m_M_min)){
+			m_M_step = 1 / m_M_step; //reached the bound of M
+		}
+	}
+	std::cout << "M = " << M << " (variance = " << variance << ", pmf time = " << time_pmf << "s, iteration time = " << time << "s), next M = " << m_M << std::endl;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -145,14 +742,77 @@ inline col3 renderer::radiance(const int x, const int y, const scene &scene, con
 	thread_local camera_path camera_path;
 
 	//generate eye sub-path
-	camera_path.construct(scene, camera, x, y, rng, m_caches);
-	const light_path &light_path = m_light_paths[x + camera.res_x() * y];
+	camera_path.construct(scene, camera, x, y, rng, m_caches, m_strategies.max_t, m_strategies.uses_resampling());
+
+	//light sub-path of this pixel
+	//(if only M light sub-paths are generated, strategies (s=0,t>=2) of the other pixels use the dummy vertex y(-1) of the first one)
+	const size_t idx = x + size_t(camera.res_x()) * y;
+	const light_path &light_path = m_light_paths[(idx < m_light_paths.size()) ? idx : 0];
+
+	//store albedo and normal at 1st vertex z(1)
+	{
+		col3 albedo, normal;
+		if(camera_path.num_vertices() >= 2){
+			albedo = camera_path(1).intersection().material().albedo();
+			normal = camera_path(1).intersection().n();
+		}
+		for(int i = 0; i < 3; i++){
+			m_albedo(x, y)[i] = albedo[i];
+			m_normal(x, y)[i] = normal[i];
+		}
+	}
+
+	//contributions of strategies of this pixel for per-strategy buffers (memory is reused between pixels)
+	thread_local std::vector<col3> strategy_L;
+	col3 *p_strategy_L = nullptr;
+	if(m_strategy_split != split_none){
+		strategy_L.assign(m_strategy_buffers.size(), col3());
+		p_strategy_L = strategy_L.data();
+	}
 
 	//calculate contributions of strategies (s>=1,t=1) and store them in m_buf_s1
-	calculate_s1(scene, camera, light_path, camera_path, rng);
+	if(m_strategies.s1){
+		const strategy_scope scope(*this, group_s1);
+		calculate_s1(scene, camera, light_path, camera_path, rng);
+	}
+
+	//calculate contributions of connection strategies (s>=1,t>=2) (resampling strategies, or connections with the light sub-path in standard BPT)
+	col3 L_st;
+	{
+		const strategy_scope scope(*this, group_st);
+		if(m_strategies.connection == strategy_set::connect_light_path){
+			L_st = calculate_connections(scene, light_path, camera_path, p_strategy_L);
+		}else{
+			L_st = calculate_st(scene, camera_path, rng, p_strategy_L);
+		}
+	}
+	if(m_M_min != m_M_max){
+		m_lum_st[x + camera.res_x() * y] = luminance(L_st);
+	}
+	col3 L_vm;
+	if(m_vm_eta > 0){
+		const strategy_scope scope(*this, group_vm);
+		L_vm = calculate_vm(scene, camera_path, p_strategy_L);
+	}
+	col3 L_0t;
+	{
+		const strategy_scope scope(*this, group_0t);
+		L_0t = calculate_0t(scene, light_path, camera_path);
+	}
+	const col3 L = L_0t + L_st + L_vm;
 
-	//calculate contributions of resampling strategies (s>=1,t>=2) and strategies (s=0,t>=2)
-	return calculate_0t(scene, light_path, camera_path) + calculate_st(scene, camera_path, rng);
+	//store contributions in per-strategy buffers (pixels with NaN are skipped as in the screen)
+	if((p_strategy_L != nullptr) && !(std::isnan(L[0] + L[1] + L[2]))){
+		p_strategy_L[strategy_buffer_index(group_0t, 0, camera_path.num_vertices())] += L_0t;
+		for(size_t i = 0; i < strategy_L.size(); i++){
+			if(is_splatted_strategy_buffer(i) == false){
+				for(int c = 0; c < 3; c++){
+					m_strategy_buffers[i](x, y)[c] = p_strategy_L[i][c];
+				}
+			}
+		}
+	}
+	return L;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -172,7 +832,7 @@ inline col3 renderer::calculate_0t(const scene &scene, const light_path &y, cons
 			const col3 Le = ztm1_isect.material().Le(ztm1_isect, ztm1.wo());
 
 			const float mis_weight = 1 / (
-				0 + 1 + camera_path::mis_partial_weight(scene, y, 0, z, t, direction(), ztm1.wi(), m_M, m_Qp)
+				0 + 1 + camera_path::mis_partial_weight(scene, y, 0, z, t, direction(), ztm1.wi(), m_M, m_Qp, m_vm_eta, m_strategies)
 			);
 			return Le * ztm1.throughput_We() * mis_weight;
 		}
@@ -186,7 +846,7 @@ inline col3 renderer::calculate_0t(const scene &scene, const light_path &y, cons
 inline void renderer::calculate_s1(const scene &scene, const camera &camera, const light_path &y, const camera_path &z, random_number_generator &rng)
 {
 	for(size_t s = 1, nL = y.num_vertices(); s <= nL; s++){
-		
+
 		const auto &z0 = z(0);
 		const auto &ysm1 = y(s - 1);
 		const auto &z0_isect = z(0).intersection();
@@ -217,15 +877,25 @@ inline void renderer::calculate_s1(const scene &scene, const camera &camera, con
 				const float G = yz.abs_cos() * zy.abs_cos() / dist2;
 
 				const float mis_weight = m_ns1 / (
-					light_path::mis_partial_weight(y, s, z, 1, yz, zy, m_M, m_Qp) + m_ns1 + 0
+					light_path::mis_partial_weight(y, s, z, 1, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies) + m_ns1 + 0
 				);
 				const col3 contrib = ysm1.Le_throughput() * fyz * (We * G / z0.pdf_fwd() * mis_weight);
 
 				//update m_buf_s1 using spinlock
-				std::lock_guard<spinlock> lock(m_locks[screen_pos.x + camera.res_x() * screen_pos.y]);
-				m_buf_s1(screen_pos.x, screen_pos.y)[0] += contrib[0];
-				m_buf_s1(screen_pos.x, screen_pos.y)[1] += contrib[1];
-				m_buf_s1(screen_pos.x, screen_pos.y)[2] += contrib[2];
+				const int x = screen_pos.x, py = screen_pos.y;
+				std::lock_guard<spinlock> lock(m_locks[m_buf_s1.index(x, py)]);
+				m_buf_s1(x, py)[0] += contrib[0];
+				m_buf_s1(x, py)[1] += contrib[1];
+				m_buf_s1(x, py)[2] += contrib[2];
+
+				//per-strategy buffer is updated under the same spinlock
+				if(m_strategy_split != split_none){
+					auto *p = m_strategy_buffers[strategy_buffer_index(group_s1, s, 1)](x, py);
+					const float inv_ns1 = 1 / float(m_ns1);
+					p[0] += contrib[0] * inv_ns1;
+					p[1] += contrib[1] * inv_ns1;
+					p[2] += contrib[2] * inv_ns1;
+				}
 			}
 		}
 	}
@@ -234,7 +904,7 @@ inline void renderer::calculate_s1(const scene &scene, const camera &camera, con
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 //calculate contributions for resampling estimators
-inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, random_number_generator &rng)
+inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, random_number_generator &rng, col3 *p_strategy_L)
 {
 	const size_t nE = z.num_vertices();
 
@@ -248,20 +918,21 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 			continue;
 		}
 
-		//sample cache point uniformly (i.e, P_c(i)=1/(Nc+1) in Sec. 5.2)
+		//sample cache point according to P_c in Sec. 5.2 (neighbor cache points with zero normalization constants are not selected)
+		const auto Pc = cache_selection_pmf(ztm1, m_strategies.virtual_cache);
 		size_t cache_idx = Nc;
-		float pmf = 1 / float(Nc + 1);
 		{
 			float u = rng.generate_uniform_real();
 			for(size_t i = 0; i < Nc; i++){
-				if(u < 1 / float(Nc + 1)){
+				if(u < Pc[i]){
 					cache_idx = i; break;
 				}
-				u -= 1 / float(Nc + 1);
+				u -= Pc[i];
 			}
 		}
-		if((cache_idx != Nc) && (ztm1.neighbor_cache(cache_idx).normalization_constant() == 0)){
-			continue;
+		float pmf = Pc[cache_idx];
+		if(!(pmf > 0)){
+			continue; //no cache point can be selected (virtual cache point is disabled)
 		}
 
 		//resample light sub-path  (Line13 in Algorithm1)
@@ -315,30 +986,186 @@ inline col3 renderer::calculate_st(const scene &scene, const camera_path &z, ran
 					const float Le_throughput_FGVc = ztm1.neighbor_cache(i).pmf(sample_idx) * ztm1.neighbor_cache(i).normalization_constant();
 				
 					if(Le_throughput_FGVc > 0){
-						const float tmp_val = (1 / float(Nc + 1)) * m_M / (
-							(m_M - 1) * std::max(mis_threshold, Q / Le_throughput_FGVc) + 1
-						);
+						const float tmp_val = Pc[i] * m_strategies.resampling_ratio(m_M, std::max(mis_threshold, Q / Le_throughput_FGVc));
 						if(cache_idx == i){
 							val = tmp_val;
 						}
 						sum_val += tmp_val;
 					}
 				}
-				const float tmp_val = (1 / float(Nc + 1)) * m_M / (
-					(m_M - 1) * m_Qp + 1
-				);
+				const float tmp_val = Pc[Nc] * m_strategies.resampling_ratio(m_M, m_Qp);
 				if(cache_idx == Nc){
 					val = tmp_val;
 				}
 				sum_val += tmp_val;
+
+				//vertex merging at z(t-1)
+				if((m_vm_eta > 0) && m_strategies.merging(s + 1, t)){
+					sum_val += m_vm_eta * std::get<0>(light_path::pdf_FG(ztm1, ysm1, s + 1, zy, yz));
+				}
 				
 				mis_weight = val / (
-					light_path::mis_partial_weight(y, s, z, t, yz, zy, m_M, m_Qp) + sum_val + camera_path::mis_partial_weight(scene, y, s, z, t, yz, zy, m_M, m_Qp)
+					light_path::mis_partial_weight(y, s, z, t, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies) + sum_val + camera_path::mis_partial_weight(scene, y, s, z, t, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies)
 				);
 			}
 
-			L += ysm1.Le_throughput() * fyz * fzy * ztm1.throughput_We() * (G / (pmf * m_M) * mis_weight);
+			const col3 contrib = ysm1.Le_throughput() * fyz * fzy * ztm1.throughput_We() * (G / (pmf * m_M) * mis_weight);
+			if(p_strategy_L != nullptr){
+				p_strategy_L[strategy_buffer_index(group_st, s, t)] += contrib;
+			}
+			L += contrib;
+		}
+	}
+	return L;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//calculate contributions of connections of standard BPT
+//each vertex y(s-1) of the light sub-path of the pixel is connected to each vertex z(t-1) of the eye sub-path (one sample per strategy)
+inline col3 renderer::calculate_connections(const scene &scene, const light_path &y, const camera_path &z, col3 *p_strategy_L)
+{
+	const size_t nE = z.num_vertices();
+	const size_t nL = y.num_vertices();
+
+	col3 L;
+	for(size_t t = 2; t <= nE; t++){
+
+		const auto &ztm1 = z(t - 1);
+		const auto &ztm1_isect = z(t - 1).intersection();
+
+		if(ztm1_isect.material().is_emissive()){
+			continue;
+		}
+
+		for(size_t s = 1; s <= nL; s++){
+
+			if(m_strategies.resampling(s, t) == false){
+				continue;
+			}
+
+			const auto &ysm1 = y(s - 1);
+			const auto &ysm1_isect = y(s - 1).intersection();
+
+			const vec3 tmp_yz = ztm1_isect.p() - ysm1_isect.p();
+			const float dist2 = squared_norm(tmp_yz);
+			const float dist = sqrt(dist2);
+			const direction yz(tmp_yz / dist, ysm1_isect.n());
+			if(yz.is_invalid() || yz.in_lower_hemisphere()){
+				continue;
+			}
+
+			const direction zy(-yz, ztm1_isect.n());
+			if(zy.is_invalid() || zy.in_lower_hemisphere()){
+				continue;
+			}
+
+			//visibility test between y(s-1) & z(t-1)
+			if(scene.intersect(ray(ysm1_isect.p(), yz, dist))){
+				continue;
+			}
+
+			const col3 fyz = ysm1.brdf().f(yz);
+			const col3 fzy = ztm1.brdf().f(zy);
+			const float G = yz.abs_cos() * zy.abs_cos() / dist2;
+
+			//balance heuristic (pdf ratio of this strategy is 1, and vertex merging at z(t-1) is added if enabled)
+			float sum_val = 1;
+			if((m_vm_eta > 0) && m_strategies.merging(s + 1, t)){
+				sum_val += m_vm_eta * std::get<0>(light_path::pdf_FG(ztm1, ysm1, s + 1, zy, yz));
+			}
+			const float mis_weight = 1 / (
+				light_path::mis_partial_weight(y, s, z, t, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies) + sum_val + camera_path::mis_partial_weight(scene, y, s, z, t, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies)
+			);
+
+			const col3 contrib = ysm1.Le_throughput() * fyz * fzy * ztm1.throughput_We() * (G * mis_weight);
+			if(p_strategy_L != nullptr){
+				p_strategy_L[strategy_buffer_index(group_st, s, t)] += contrib;
+			}
+			L += contrib;
+		}
+	}
+	return L;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//calculate contributions of vertex merging
+//light sub-path vertex y(s-1) within radius of z(t-1) is regarded as z(t-1), so that the path y(0),...,y(s-2),z(t-1),...,z(0) is sampled.
+//MIS weights are calculated with the connection y(s-1)-z(t-2) of the same path (i.e., strategy (s,t-1)) as reference
+inline col3 renderer::calculate_vm(const scene &scene, const camera_path &z, col3 *p_strategy_L)
+{
+	const size_t nE = z.num_vertices();
+
+	col3 L;
+	for(size_t t = 2; t <= nE; t++){
+
+		const auto &ztm1 = z(t - 1);
+		const auto &ztm1_isect = z(t - 1).intersection();
+
+		if(ztm1_isect.material().is_emissive()){
+			continue;
 		}
+
+		const size_t tp = t - 1;
+		const auto &ztpm1 = z(tp - 1);
+		const auto &ztpm1_isect = z(tp - 1).intersection();
+
+		m_vm_vertices.for_each_in_radius(ztm1_isect.p(), m_vm_radius, [&](const candidate &c, const float)
+		{
+			const auto &y = c.path();
+			const auto  s = c.s();
+			const auto &ysm1 = c.vertex();
+			const auto &ysm1_isect = c.vertex().intersection();
+
+			if(dot(ysm1_isect.n(), ztm1_isect.n()) <= 0){
+				return;
+			}
+			const direction wi(vec3(ysm1.wi()), ztm1_isect.n());
+			if(wi.is_invalid() || wi.in_lower_hemisphere()){
+				return;
+			}
+
+			//directions of reference strategy (s,t-1)
+			const vec3 tmp_yz = ztpm1_isect.p() - ysm1_isect.p();
+			const direction yz(tmp_yz / norm(tmp_yz), ysm1_isect.n());
+			if(yz.is_invalid() || yz.in_lower_hemisphere()){
+				return;
+			}
+			const direction zy(-yz, ztpm1_isect.n());
+			if(zy.is_invalid() || zy.in_lower_hemisphere()){
+				return;
+			}
+
+			//partial weights are relative to pdf of strategy (s,t-1)
+			//vertex merging at y(s-1) is included in light partial weight, and merging/resampling at z(t-2) in end_term
+			const float numerator = m_vm_eta * camera_path::pdf(ysm1, ztpm1, 1 + tp, yz, zy);
+			if(!(numerator > 0)){
+				return;
+			}
+			float end_term, w_E;
+			if(tp == 1){
+				end_term = m_strategies.light_tracing(s) ? float(m_ns1) : 0;
+				w_E = 0;
+			}else{
+				end_term = connection_term(ztpm1, [&](const size_t j){
+					return luminance(ysm1.Le_throughput() * ztpm1.neighbor_cache(j).calc_FGV(scene, ysm1_isect, ysm1.brdf()));
+				}, m_M, m_Qp, m_strategies);
+				if(m_strategies.merging(s + 1, tp)){
+					end_term += m_vm_eta * std::get<0>(light_path::pdf_FG(ztpm1, ysm1, s + 1, zy, yz));
+				}
+				w_E = camera_path::mis_partial_weight(scene, y, s, z, tp, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies);
+			}
+			const float mis_weight = numerator / (
+				light_path::mis_partial_weight(y, s, z, tp, yz, zy, m_M, m_Qp, m_vm_eta, m_strategies) + end_term + w_E
+			);
+
+			const col3 contrib = ysm1.Le_throughput() * ztm1.brdf().f(wi) * ztm1.throughput_We() * (mis_weight / m_vm_eta);
+			if(p_strategy_L != nullptr){
+				p_strategy_L[strategy_buffer_index(group_vm, s, t)] += contrib;
+			}
+			L += contrib;
+		});
 	}
 	return L;
 }
@@ -5,19 +5,153 @@
  */
 
 #include"inc/sample/our.hpp"
+#include"inc/base/count_allocations.hpp"
 
+#include<array>
 #include<chrono>
+#include<string>
 #include<random>
+#include<memory>
 #include<vector>
 #include<thread>
 #include<fstream>
 #include<iostream>
 #include<algorithm>
 
+//commit of the source code (git_commit.hpp is written in the build directory at each build)
+#if defined(__has_include)
+#if __has_include("git_commit.hpp")
+#include"git_commit.hpp"
+#endif
+#endif
+#if !defined(GIT_COMMIT)
+#define GIT_COMMIT "unknown"
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char **argv)
 {
+	//command line options
+	size_t M = 200; //the number of pre-sampled light sub-paths
+	size_t M_min = 0, M_max = 0; //range of M for adaptive M (disabled if M_min == 0)
+	size_t max_iterations = 256;
+	double time_limit = 0; //rendering stops after accumulated iterations take this time in seconds (0: no limit)
+	std::string integrator = "ris-bpt"; //name of rendering algorithm (RIS-BPT or a baseline expressed as a set of strategies)
+	std::string reference_file; //reference image in PFM format for measuring the error (no error is measured if empty)
+	std::string results_file; //file of benchmark results (CSV or JSON Lines) to which the result of this run is appended (not written if empty)
+	std::string label = GIT_COMMIT; //name of the compared version in benchmark results
+	std::string config; //options affecting the result (for grouping trials in benchmark results)
+	bool adjoint_rr = false;
+	bool guiding = false;
+	bool sort_candidates = false;
+	bool quantized_pmfs = false;
+	size_t max_cluster_size = 1; //maximum number of cache points sharing a resampling pmf (1: clustering is disabled)
+	float vm_radius = 0; //initial radius of vertex merging (0: vertex merging is disabled)
+	our::strategy_set strategies; //enabled sampling strategies
+	size_t num_preview_levels = 0; //number of preview iterations at reduced resolution before max_iterations iterations
+	bool denoising = false;
+	bool perf = false; //report dTLB misses and page faults per iteration
+	bool count_allocations = false; //report heap allocations of each stage per iteration
+	size_t memory_budget = 0; //memory budget for per-iteration structures in MB (0: unlimited)
+	std::string scratch_dir; //directory for out-of-core candidate vertex table and resampling pmfs
+	std::string metrics_file; //file of metrics in Prometheus text format written after each iteration (not written if empty)
+	our::renderer::strategy_split_t strategy_split = our::renderer::split_none; //splitting of per-strategy buffers
+	std::string shm_name; //name of shared-memory segment for the accumulation buffer (not shared if empty)
+	for(int i = 1; i < argc; i++){
+
+		const std::string arg = argv[i];
+		const std::string val = arg.substr(arg.find('=') + 1);
+
+		//options of outputs are not part of the config
+		if((arg.rfind("--results=", 0) != 0) && (arg.rfind("--label=", 0) != 0) && (arg.rfind("--metrics=", 0) != 0) && (arg.rfind("--shm=", 0) != 0)){
+			config += (config.empty() ? "" : " ") + arg;
+		}
+
+		if(arg.rfind("--M=", 0) == 0){
+			M = std::stoul(val);
+		}else if(arg.rfind("--integrator=", 0) == 0){ //--integrator=ris-bpt|ris-bpt-balance|bpt|pt|lt (options after this one override its strategies)
+			integrator = val;
+			strategies = our::strategy_set();
+			if(val == "ris-bpt-balance"){
+				strategies.resampling_gain = false;
+			}else if(val == "bpt"){
+				strategies.connection = our::strategy_set::connect_light_path;
+			}else if(val == "pt"){
+				strategies.connection = our::strategy_set::connect_light_path;
+				strategies.s1 = false;
+				strategies.max_s = 1;
+			}else if(val == "lt"){
+				strategies.max_t = 1;
+			}else if(val != "ris-bpt"){
+				std::cerr << "unknown integrator: " << val << std::endl; return 1;
+			}
+		}else if(arg.rfind("--adaptive-M=", 0) == 0){ //--adaptive-M=min,max
+			M_min = std::stoul(val);
+			M_max = std::stoul(val.substr(val.find(',') + 1));
+		}else if(arg == "--adjoint-rr"){
+			adjoint_rr = true;
+		}else if(arg == "--guiding"){
+			guiding = true;
+		}else if(arg == "--sort-candidates"){
+			sort_candidates = true;
+		}else if(arg == "--quantized-pmfs"){
+			quantized_pmfs = true;
+		}else if(arg.rfind("--cluster-caches=", 0) == 0){
+			max_cluster_size = std::stoul(val);
+		}else if(arg.rfind("--vm-radius=", 0) == 0){
+			vm_radius = std::stof(val);
+		}else if(arg == "--no-light-tracing"){
+			strategies.s1 = false;
+		}else if(arg == "--no-virtual-cache"){
+			strategies.virtual_cache = false;
+		}else if(arg == "--no-mis-visibility-cache"){
+			strategies.cached_visibility = false;
+		}else if(arg.rfind("--max-s=", 0) == 0){
+			strategies.max_s = std::max<size_t>(std::stoul(val), 1);
+		}else if(arg.rfind("--max-t=", 0) == 0){
+			strategies.max_t = std::max<size_t>(std::stoul(val), 1);
+		}else if(arg.rfind("--preview=", 0) == 0){
+			num_preview_levels = std::stoul(val);
+		}else if(arg == "--denoise"){
+			denoising = true;
+		}else if(arg == "--no-huge-pages"){
+			use_huge_pages = false;
+		}else if(arg == "--perf"){
+			perf = true;
+		}else if(arg == "--count-allocations"){
+			count_allocations = true;
+		}else if(arg.rfind("--memory-budget=", 0) == 0){
+			memory_budget = std::stoul(val);
+		}else if(arg.rfind("--scratch-dir=", 0) == 0){
+			scratch_dir = val;
+		}else if(arg.rfind("--metrics=", 0) == 0){
+			metrics_file = val;
+		}else if(arg.rfind("--strategy-buffers=", 0) == 0){ //--strategy-buffers=group|st
+			if(val == "group"){
+				strategy_split = our::renderer::split_group;
+			}else if(val == "st"){
+				strategy_split = our::renderer::split_st;
+			}else{
+				std::cerr << "unknown splitting of strategy buffers: " << val << std::endl; return 1;
+			}
+		}else if(arg.rfind("--shm=", 0) == 0){
+			shm_name = val;
+		}else if(arg.rfind("--iterations=", 0) == 0){
+			max_iterations = std::stoul(val);
+		}else if(arg.rfind("--time-limit=", 0) == 0){
+			time_limit = std::stod(val);
+		}else if(arg.rfind("--reference=", 0) == 0){
+			reference_file = val;
+		}else if(arg.rfind("--results=", 0) == 0){
+			results_file = val;
+		}else if(arg.rfind("--label=", 0) == 0){
+			label = val;
+		}else{
+			std::cerr << "unknown option: " << arg << std::endl; return 1;
+		}
+	}
+
 	//scene setup
 	const scene scene(std::vector<object>{
 		object(sphere(vec3(1 - 1e+3f, 0, 0), 1e+3f), material(col3(0.14f, 0.45f, 0.091f), false)), //+X
@@ -39,34 +173,301 @@ int main(int argc, char **argv)
 	const float fovy = 40;
 	const camera camera(vec3(0, 0, 1 / tan(conv_deg_to_rad(fovy / 2)) + 1), vec3(0, 0, 0), 512, 512, fovy, 0.0);
 
+	//reference image for measuring the error of the accumulated image
+	imagef reference;
+	if(!reference_file.empty()){
+		reference = load_pfm(reference_file);
+		if((reference.width() != camera.res_x()) || (reference.height() != camera.res_y())){
+			std::cerr << "failed to load reference image " << reference_file << " (" << camera.res_x() << "x" << camera.res_y() << " PFM is required)" << std::endl; return 1;
+		}
+	}
+
+	//event counters (created before the renderer, since counters only inherit to threads created after them and the renderer starts its worker threads on construction)
+	const perf_counter dtlb_misses(perf ? perf_counter::dtlb_load_misses : perf_counter::none);
+	const perf_counter page_faults(perf ? perf_counter::page_faults : perf_counter::none);
+
 	//parameter setup
-	const size_t M = 200; //the number of pre-sampled light sub-paths
 	our::renderer renderer(scene, camera, M);
+	if(M_min > 0){
+		renderer.set_adaptive_M(M_min, M_max);
+	}
+	renderer.set_adjoint_rr(adjoint_rr);
+	renderer.set_guiding(guiding);
+	renderer.set_candidate_sorting(sort_candidates);
+	renderer.set_quantized_pmfs(quantized_pmfs);
+	renderer.set_cache_clustering(max_cluster_size);
+	renderer.set_vertex_merging(vm_radius);
+	renderer.set_strategies(strategies);
+	renderer.set_preview(num_preview_levels);
+	renderer.set_scratch_directory(scratch_dir);
+	renderer.set_memory_budget(memory_budget << 20);
+	renderer.set_strategy_buffers(strategy_split);
 
 	//buffer for storing rendering results
+	//(with --shm, results are accumulated directly in the shared-memory segment read by a viewer process)
 	const int w = camera.res_x();
 	const int h = camera.res_y();
-	imaged sum(w, h);
+	std::unique_ptr<shared_framebuffer> framebuffer;
+	imaged sum;
+	if(!shm_name.empty()){
+		framebuffer = std::make_unique<shared_framebuffer>(shm_name, w, h);
+	}
+	if((framebuffer == nullptr) || (framebuffer->is_valid() == false)){
+		framebuffer.reset();
+		sum = imaged(w, h);
+	}
+	double *p_sum = (framebuffer != nullptr) ? framebuffer->data() : sum(0,0);
+
+	//buffers for denoising (squared sum of results for variance, first-hit albedo/normal)
+	//(squared sum is also used to estimate the error of the image for metrics)
+	const bool metrics = !metrics_file.empty();
+	imaged sum2, sum_albedo, sum_normal;
+	if(denoising || metrics){
+		sum2 = imaged(w, h);
+	}
+	if(denoising){
+		sum_albedo = imaged(w, h);
+		sum_normal = imaged(w, h);
+	}
+
+	//RMS error of the mean of accumulated iterations relative to the reference image (-1 if no reference is given)
+	auto reference_rmse = [&](const size_t num_accumulated){
+		return (reference_file.empty() || (num_accumulated == 0)) ? -1.0 : calc_rmse(p_sum, num_accumulated, reference);
+	};
+
+	//efficiency 1/(MSE*time) (0 if the error or the time is 0)
+	auto efficiency = [](const double rmse, const double time){
+		return ((rmse > 0) && (time > 0)) ? 1 / (rmse * rmse * time) : 0.0;
+	};
 
 	//rendering algorithm shown in Algorithm 1 on Page 6
-	const size_t max_iterations = 256;
-	for(size_t n = 0; n < max_iterations; n++){
+	//preview iterations are not accumulated. each preview replaces the buffer (so that a viewer process shows it),
+	//and the first full-resolution iteration overwrites the last preview
+	imagef result; //result of each iteration (memory is reused)
+	size_t num_accumulated = 0;
+	double render_time = 0; //total time of accumulated iterations
+	std::array<double, our::renderer::num_stages> accumulated_stage_times = {}; //time of each stage in accumulated iterations
+	ray_count accumulated_rays = { 0, 0 }; //rays traced in accumulated iterations
+	uint64_t accumulated_knn_lookups = 0; //kNN lookups of cache points in accumulated iterations
+	double accumulated_knn_seconds = 0;   //estimated time of the kNN lookups (summed over threads)
+	for(size_t n = 0; n < num_preview_levels + max_iterations; n++){
+
+		//equal-time comparisons stop after the time limit (previews are not counted)
+		if((time_limit > 0) && (render_time >= time_limit)){
+			break;
+		}
 
 		std::cout << "iteration = " << n << std::endl;
 
-		const imagef result = renderer.render(scene, camera);
+		const uint64_t dtlb_misses0 = dtlb_misses.read();
+		const uint64_t page_faults0 = page_faults.read();
+		const uint64_t knn_lookups0 = num_knn_lookups.value();
+		const uint64_t knn_nanoseconds0 = knn_sampled_nanoseconds.value();
 
-		for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
-			sum(0,0)[i] += result(0,0)[i];
+		const auto start = std::chrono::steady_clock::now();
+		renderer.render(scene, camera, result);
+		const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const bool preview = renderer.is_preview();
+		if(preview){
+			std::cout << "preview at 1/" << (size_t(1) << (num_preview_levels - n)) << " resolution: " << time << "s" << std::endl;
+		}
+
+		if(perf){
+			auto report = [](const perf_counter &c, const uint64_t c0){ return c.is_valid() ? std::to_string(c.read() - c0) : std::string("n/a"); };
+			std::cout << "dTLB misses = " << report(dtlb_misses, dtlb_misses0) << ", page faults = " << report(page_faults, page_faults0) << std::endl;
+		}
+		if(count_allocations){
+			std::cout << "allocations:";
+			for(int i = 0; i < our::renderer::num_stages; i++){
+				const auto stage = our::renderer::stage_t(i);
+				std::cout << (i ? ", " : " ") << our::renderer::stage_name(stage) << " = " << renderer.allocations()[stage];
+			}
+			std::cout << std::endl;
+		}
+
+		if((strategy_split != our::renderer::split_none) && (preview == false)){
+			std::cout << "strategies:";
+			for(int i = 0; i < our::renderer::num_strategy_groups; i++){
+				const auto group = our::renderer::strategy_group_t(i);
+				const auto &stats = renderer.strategy_costs()[group];
+				std::cout << (i ? ", " : " ") << our::renderer::strategy_group_name(group) << " = " << stats.time << "s (" << stats.shadow_rays << " shadow rays)";
+			}
+			std::cout << std::endl;
+		}
+
+		if(framebuffer != nullptr){
+			framebuffer->begin_write();
+		}
+		if(preview || (num_accumulated == 0)){
+			for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
+				p_sum[i] = result(0,0)[i];
+			}
+		}else{
+			for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
+				p_sum[i] += result(0,0)[i];
+			}
+		}
+		if(preview == false){
+			num_accumulated++;
+			render_time += time;
+			for(int i = 0; i < our::renderer::num_stages; i++){
+				accumulated_stage_times[i] += renderer.times()[i];
+				accumulated_rays.closest_hit += renderer.rays()[i].closest_hit;
+				accumulated_rays.shadow += renderer.rays()[i].shadow;
+			}
+			accumulated_knn_lookups += num_knn_lookups.value() - knn_lookups0;
+			accumulated_knn_seconds += (knn_sampled_nanoseconds.value() - knn_nanoseconds0) * 1e-9 * knn_sample_interval;
+		}
+		if(framebuffer != nullptr){
+			framebuffer->end_write(preview ? 1 : num_accumulated);
+		}
+		if((denoising || metrics) && (preview == false)){
+			for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
+				sum2(0,0)[i] += result(0,0)[i] * result(0,0)[i];
+			}
+		}
+		if(denoising && (preview == false)){
+			for(int i = 0, npixel = 3 * w * h; i < npixel; i++){
+				sum_albedo(0,0)[i] += renderer.albedo()(0,0)[i];
+				sum_normal(0,0)[i] += renderer.normal()(0,0)[i];
+			}
+		}
+
+		//report time and error of accumulated iterations
+		const double rmse = reference_rmse(num_accumulated);
+		if(preview == false){
+			std::cout << "time = " << time << "s (total " << render_time << "s)";
+			if(rmse >= 0){
+				std::cout << ", rmse = " << rmse;
+			}
+			std::cout << std::endl;
+		}
+
+		//write metrics (rays are counted for all iterations, the other rates and the error for accumulated iterations)
+		if(metrics){
+			double relative_error;
+			const double error = estimate_rmse(p_sum, sum2(0,0), size_t(3) * w * h, num_accumulated, relative_error);
+
+			prometheus_writer writer;
+			writer.family("ris_bpt_iterations_total", "counter", "Number of accumulated iterations.");
+			writer.sample(double(num_accumulated));
+			writer.family("ris_bpt_iterations_per_second", "gauge", "Accumulated iterations per second of rendering time.");
+			writer.sample((render_time > 0) ? num_accumulated / render_time : 0);
+			writer.family("ris_bpt_iteration_seconds", "gauge", "Time of the last iteration.");
+			writer.sample(time);
+			renderer.write_metrics(writer, time);
+			writer.family("ris_bpt_resident_memory_bytes", "gauge", "Resident memory of the renderer process.");
+			writer.sample(double(resident_memory_bytes()));
+			writer.family("ris_bpt_estimated_rmse", "gauge", "RMS error of the accumulated image estimated from per-pixel variance.");
+			writer.sample(error);
+			writer.family("ris_bpt_estimated_relative_error", "gauge", "Estimated RMS error relative to the mean pixel value.");
+			writer.sample(relative_error);
+			if(rmse >= 0){
+				writer.family("ris_bpt_reference_rmse", "gauge", "RMS error of the accumulated image relative to the reference image.");
+				writer.sample(rmse);
+			}
+			if(writer.write(metrics_file) == false){
+				std::cerr << "failed to write metrics to " << metrics_file << std::endl;
+			}
 		}
 	}
 
-	//save image as test.bmp
-	image result(w, h);
+	//save image with gamma correction
+	auto save = [&](const imagef &img, const std::string &filename){
+		image result(w, h);
+		for(int i = 0, n = 3 * w * h; i < n; i++){
+			result(0,0)[i] = (unsigned char) (clamp(pow(img(0,0)[i], 1.0f / 2.2f), 0, 1) * 255 ); //gamma_correction
+		}
+		save_as_bmp(result, filename);
+	};
+
+	//summary of the run for efficiency comparisons (efficiency is 1/(MSE*time) if the reference image is given)
+	{
+		std::cout << "integrator = " << integrator << ", iterations = " << num_accumulated << ", time = " << render_time << "s";
+		const double rmse = reference_rmse(num_accumulated);
+		if(rmse >= 0){
+			std::cout << ", rmse = " << rmse << ", efficiency = " << efficiency(rmse, render_time);
+		}
+		std::cout << std::endl;
+	}
+
+	//append result of this run to benchmark results (per-iteration times of stages, e.g., stage_pmfs_seconds for construction of resampling pmfs)
+	if(!results_file.empty() && (num_accumulated > 0)){
+		benchmark_result result;
+		result.label = label;
+		result.commit = GIT_COMMIT;
+		result.machine = machine_fingerprint();
+		result.config = config;
+		result.add("iterations", double(num_accumulated));
+		result.add("seconds_per_iteration", render_time / num_accumulated);
+		for(int i = 0; i < our::renderer::num_stages; i++){
+			std::string name = our::renderer::stage_name(our::renderer::stage_t(i));
+			std::replace(name.begin(), name.end(), ' ', '_');
+			result.add("stage_" + name + "_seconds", accumulated_stage_times[i] / num_accumulated);
+		}
+		result.add("closest_hit_rays_per_second", accumulated_rays.closest_hit / render_time);
+		result.add("shadow_rays_per_second", accumulated_rays.shadow / render_time);
+		result.add("knn_lookups_per_iteration", double(accumulated_knn_lookups) / num_accumulated);
+		result.add("knn_lookup_seconds", accumulated_knn_seconds / num_accumulated);
+		const double rmse = reference_rmse(num_accumulated);
+		if(rmse >= 0){
+			result.add("rmse", rmse);
+			result.add("efficiency", efficiency(rmse, render_time));
+		}
+		if(append_benchmark_result(result, results_file) == false){
+			std::cerr << "failed to write benchmark result to " << results_file << std::endl;
+		}
+	}
+
+	//save image as test.bmp (and linear HDR image as test.pfm, e.g., for references)
+	const size_t num_iterations = std::max<size_t>(num_accumulated, 1);
+	imagef mean(w, h);
 	for(int i = 0, n = 3 * w * h; i < n; i++){
-		result(0,0)[i] = (unsigned char) (clamp(pow(float(sum(0,0)[i] / max_iterations ), 1.0f / 2.2f), 0, 1) * 255 ); //gamma_correction
+		mean(0,0)[i] = float(p_sum[i] / num_iterations);
+	}
+	save(mean, "test.bmp");
+	save_as_pfm(mean, "test.pfm");
+
+	//save per-strategy images as test_<strategy>.bmp (strategies without contributions are skipped)
+	//and report mean pixel value of each strategy and its share of the image
+	if((strategy_split != our::renderer::split_none) && (num_accumulated > 0)){
+		double total = 0;
+		for(int i = 0, n = 3 * w * h; i < n; i++){
+			total += mean(0,0)[i];
+		}
+		imagef strategy_mean(w, h);
+		for(size_t k = 0; k < renderer.num_strategy_buffers(); k++){
+			double sum = 0;
+			for(int i = 0, n = 3 * w * h; i < n; i++){
+				strategy_mean(0,0)[i] = renderer.strategy_sum(k)(0,0)[i] / num_iterations;
+				sum += strategy_mean(0,0)[i];
+			}
+			if(sum != 0){
+				const std::string name = renderer.strategy_buffer_name(k);
+				std::cout << "strategy " << name << ": mean = " << sum / (3 * w * h) << " (" << 100 * sum / total << "%)" << std::endl;
+				save(strategy_mean, "test_" + name + ".bmp");
+			}
+		}
+	}
+
+	//denoise image (post-process) and save it as test_denoised.bmp
+	if(denoising){
+
+		const auto start = std::chrono::steady_clock::now();
+
+		//variance of mean and averaged feature buffers
+		imagef variance(w, h), albedo(w, h), normal(w, h);
+		for(int i = 0, n = 3 * w * h; i < n; i++){
+			const double m = p_sum[i] / num_iterations;
+			variance(0,0)[i] = float(std::max(sum2(0,0)[i] / num_iterations - m * m, 0.0) / std::max<size_t>(num_iterations - 1, 1));
+			albedo(0,0)[i] = float(sum_albedo(0,0)[i] / num_iterations);
+			normal(0,0)[i] = float(sum_normal(0,0)[i] / num_iterations);
+		}
+		const imagef denoised = denoise(mean, variance, albedo, normal);
+
+		std::cout << "denoising time = " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+		save(denoised, "test_denoised.bmp");
 	}
-	save_as_bmp(result, "test.bmp");
 	return 0;
 }
 